@@ -0,0 +1,27 @@
+// -*- mode: c++ -*-
+/**
+   \file
+   \brief C string.h
+
+   See http://pubs.opengroup.org/onlinepubs/9699919799/basedefs/string.h.html
+
+   Only the functions the kernel uses (or the compiler may call) are
+   declared. They are implemented in kernel/exec/string.cpp.
+*/
+
+#ifndef _STRING_H
+#define _STRING_H
+
+#include <stddef.h>
+
+extern "C" {
+    void *memchr(const void *, int, size_t);
+    int memcmp(const void *, const void *, size_t);
+    void *memcpy(void *, const void *, size_t);
+    void *memmove(void *, const void *, size_t);
+    void *memset(void *, int, size_t);
+    size_t strlen(const char *);
+    size_t strnlen(const char *, size_t);
+}
+
+#endif
@@ -0,0 +1,168 @@
+// -*- mode: c++ -*-
+/**
+   \brief ACPI tables (implementation)
+   \file
+*/
+
+#include <assert.h>
+#include <stddef.h>
+
+#include "exec/acpi.hpp"
+#include "exec/aspace.hpp"
+#include "exec/memory.hpp"
+#include "exec/memtype.hpp"
+#include "exec/pagetable.hpp"
+#include "exec/util.hpp"
+
+using namespace exec;
+
+/** \defgroup exec_acpi ACPI: firmware tables
+
+    The firmware describes the machine in a tree of tables rooted at the Root
+    System Description Pointer (RSDP), which is somewhere in the first KiB of
+    the EBDA or in the BIOS ROM between 0xe0000 and 0xfffff, on a 16 byte
+    boundary. The RSDP points to the RSDT (or, from ACPI 2.0, the XSDT, which
+    has 64 bit pointers), which lists every other table.
+
+    Tables are read through the direct map of physical memory. The bootloader
+    only maps the areas the E820 map says hold RAM or ACPI tables, but some
+    firmware puts tables in reserved memory, so any pages that aren't yet
+    mapped are mapped read-only on demand.
+
+    \bug only static tables are supported; there is no AML interpreter.
+
+    @{
+*/
+
+const ACPI::Header *ACPI::root = NULL;
+bool ACPI::extended = false;
+
+/** @} */
+
+namespace {
+    //! Root System Description Pointer
+    struct RSDP {
+        char signature[8];      //!< "RSD PTR "
+        uint8_t checksum;       //!< makes the first 20 bytes sum to zero
+        char oem_id[6];         //!< identifies the OEM
+        uint8_t revision;       //!< 0 for ACPI 1.0, 2 for ACPI 2.0 or later
+        uint32_t rsdt;          //!< physical address of the RSDT
+        // ACPI 2.0 and later
+        uint32_t length;        //!< length of this structure
+        uint64_t xsdt;          //!< physical address of the XSDT
+        uint8_t extended_checksum; //!< makes the whole structure sum to zero
+        uint8_t reserved[3];    //!< reserved
+    } __attribute__((packed));
+
+    const uint64_t BDA_EBDA_SEGMENT = 0x40e;  //!< where the BDA keeps the EBDA's segment
+    const uint64_t BIOS_BEGIN = 0xe0000;
+    const uint64_t BIOS_END = 0x100000;
+
+    //! \returns true if a range of bytes sums to zero
+    bool checksum(const void *data, size_t length)
+    {
+        const uint8_t *bytes = static_cast<const uint8_t *>(data);
+        uint8_t sum = 0;
+        for(size_t i = 0; i < length; ++i)
+            sum = uint8_t(sum + bytes[i]);
+        return sum == 0;
+    }
+
+    bool same_signature(const char *left, const char *right, size_t length)
+    {
+        for(size_t i = 0; i < length; ++i)
+            if(left[i] != right[i])
+                return false;
+        return true;
+    }
+
+    //! searches a range of low memory (which is always mapped) for the RSDP
+    const RSDP *find_rsdp(uint64_t begin, uint64_t end)
+    {
+        for(uint64_t address = round_up(begin, uint64_t(16)); address + sizeof(RSDP) <= end; address += 16) {
+            const RSDP *rsdp = reinterpret_cast<const RSDP *>(PageTable::virt(address));
+            if(same_signature(rsdp->signature, "RSD PTR ", 8) && checksum(rsdp, 20))
+                return rsdp;
+        }
+        return NULL;
+    }
+}
+
+
+
+/* ====================================================================== */
+/** \brief makes sure a range of physical memory is in the direct map
+    \param physical the start of the range
+    \param length the length of the range
+    \returns the direct-mapped address of the range */
+const char *ACPI::map(uint64_t physical, size_t length)
+{
+    AddressSpace &kernel = AddressSpace::kernel();
+    PageTable tables(kernel.root());
+    uint64_t end = round_up(physical + length, uint64_t(Heap::PAGE_SIZE));
+    for(uint64_t page = round_down(physical, uint64_t(Heap::PAGE_SIZE)); page < end; page += Heap::PAGE_SIZE) {
+        PageTable::Physical mapped;
+        if(tables.translate(PageTable::virt(page), mapped))
+            continue;
+        MemoryType::Type type = MemoryType::mtrr(page, page + Heap::PAGE_SIZE);
+        bool ok = kernel.map(PageTable::virt(page), page, Heap::PAGE_SIZE, 0, type == MemoryType::MIXED ? MemoryType::UC : type);
+        assert(ok && "out of memory mapping ACPI tables");
+        (void)ok;
+    }
+    return PageTable::virt(physical);
+}
+/** \brief maps a whole table, having read its length from its header
+    \returns the table, or NULL if its checksum is wrong */
+const ACPI::Header *ACPI::map_table(uint64_t physical)
+{
+    const Header *header = reinterpret_cast<const Header *>(map(physical, sizeof(Header)));
+    map(physical, header->length);
+    return checksum(header, header->length) ? header : NULL;
+}
+/** \brief finds the root of the tables
+    \returns true if the tables were found */
+bool ACPI::init(void)
+{
+    uint64_t ebda = uint64_t(*reinterpret_cast<const uint16_t *>(PageTable::virt(BDA_EBDA_SEGMENT))) << 4;
+    const RSDP *rsdp = NULL;
+    if(ebda)
+        rsdp = find_rsdp(ebda, ebda + 1024);
+    if(!rsdp)
+        rsdp = find_rsdp(BIOS_BEGIN, BIOS_END);
+    if(!rsdp)
+        return false;
+
+    if(rsdp->revision >= 2 && rsdp->xsdt && checksum(rsdp, rsdp->length)) {
+        root = map_table(rsdp->xsdt);
+        extended = true;
+    }
+    if(!root) {
+        root = map_table(rsdp->rsdt);
+        extended = false;
+    }
+    return root;
+}
+/** \brief finds a table
+    \param signature the table's four character signature
+    \returns the first table with a valid checksum and the signature, or NULL
+    if there isn't one */
+const ACPI::Header *ACPI::find(const char *signature)
+{
+    if(!root)
+        return NULL;
+    const char *entries = reinterpret_cast<const char *>(root + 1);
+    size_t
+        entry_size = extended ? 8 : 4,
+        count = (root->length - sizeof(Header)) / entry_size;
+    for(size_t i = 0; i < count; ++i) {
+        uint64_t physical = extended
+            ? *reinterpret_cast<const uint64_t *>(entries + i * entry_size)
+            : *reinterpret_cast<const uint32_t *>(entries + i * entry_size);
+        const Header *header = reinterpret_cast<const Header *>(map(physical, sizeof(Header)));
+        if(!same_signature(header->signature, signature, 4))
+            continue;
+        if(const Header *table = map_table(physical))
+            return table;
+    }
+    return NULL;
+}
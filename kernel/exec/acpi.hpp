@@ -0,0 +1,77 @@
+// -*- mode: c++ -*-
+/**
+   \brief ACPI tables (headers)
+   \file
+*/
+
+#ifndef EXEC_ACPI_HPP
+#define EXEC_ACPI_HPP
+
+/** \addtogroup exec_acpi
+    @{ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "exec/types.hpp"
+
+/** \brief finds the tables the firmware describes the machine with */
+class exec::ACPI {
+public:
+    //! the header common to every system description table
+    struct Header {
+        char signature[4];      //!< identifies the table, e.g. "APIC"
+        uint32_t length;        //!< length of the table, including this header
+        uint8_t revision;       //!< version of the table's structure
+        uint8_t checksum;       //!< makes the bytes of the table sum to zero
+        char oem_id[6];         //!< identifies the OEM
+        char oem_table_id[8];   //!< identifies the OEM's table
+        uint32_t oem_revision;  //!< OEM's revision of the table
+        uint32_t creator_id;    //!< vendor of the tool that made the table
+        uint32_t creator_revision; //!< revision of the tool that made the table
+    } __attribute__((packed));
+
+    //! the MADT (signature "APIC"), which follows its Header
+    struct MADT {
+        uint32_t apic_address;  //!< physical address of the local APICs
+        uint32_t flags;         //!< bit 0: there are also dual 8259 PICs
+    } __attribute__((packed));
+
+    //! the header of each entry in the MADT
+    struct MADTEntry {
+        uint8_t type;           //!< what the entry describes
+        uint8_t length;         //!< length of the entry, including this header
+    } __attribute__((packed));
+private:
+    static const Header *root;  //!< the RSDT or XSDT, or NULL if not found
+    static bool extended;       //!< whether #root is the XSDT (with 64 bit pointers)
+
+    static const char *map(uint64_t, size_t);
+    static const Header *map_table(uint64_t);
+public:
+    static bool init(void);
+    static const Header *find(const char *);
+    /** \brief calls a function for each entry in the MADT
+        \param function called with each MADTEntry
+        \returns the MADT, or NULL if there isn't one */
+    template <typename F> static const MADT *for_each_madt_entry(F function)
+    {
+        const Header *header = find("APIC");
+        if(!header)
+            return NULL;
+        const MADT *madt = reinterpret_cast<const MADT *>(header + 1);
+        const char *end = reinterpret_cast<const char *>(header) + header->length;
+        for(const char *e = reinterpret_cast<const char *>(madt + 1); e + sizeof(MADTEntry) <= end; ) {
+            const MADTEntry *entry = reinterpret_cast<const MADTEntry *>(e);
+            if(entry->length < sizeof(MADTEntry))
+                break;
+            function(*entry);
+            e += entry->length;
+        }
+        return madt;
+    }
+};
+
+/** @} */
+
+#endif
@@ -0,0 +1,169 @@
+// -*- mode: c++ -*-
+/**
+   \brief Local APIC (implementation)
+   \file
+*/
+
+#include <assert.h>
+#include <stddef.h>
+
+#include "exec/apic.hpp"
+#include "exec/aspace.hpp"
+#include "exec/interrupt.hpp"
+#include "exec/memory.hpp"
+#include "exec/pagetable.hpp"
+#include "exec/percpu.hpp"
+#include "exec/tsc.hpp"
+#include "exec/x86.hpp"
+
+using namespace exec;
+
+/** \defgroup exec_apic LocalAPIC: per-processor interrupt controller
+
+    The local APIC is used in xAPIC mode, through its memory-mapped registers,
+    which are mapped uncached at their physical address in the direct map.
+
+    Inter-processor interrupts are sent by writing the destination to the
+    high half of the Interrupt Command Register (ICR) and then the vector and
+    delivery mode to the low half, which sends it. The delivery status bit
+    then stays set until the interrupt has been accepted.
+
+    The timer counts down from its initial count at the bus clock divided by
+    16, and in periodic mode reloads and interrupts (on Interrupt::TIMER)
+    when it reaches zero. The bus clock isn't reported anywhere, so it's
+    measured against the TSC the first time the timer is started; it's
+    assumed to be the same on every processor.
+
+    @{
+*/
+
+volatile uint32_t *LocalAPIC::registers = NULL;
+uint32_t LocalAPIC::timer_khz = 0;
+uint64_t LocalAPIC::tick_count EXEC_PERCPU = 0;
+
+/** @} */
+
+namespace {
+    const uint32_t MSR_APIC_BASE = 0x1b;
+    const uint64_t APIC_BASE_ENABLE = 1 << 11;
+
+    const uint32_t REG_SVR = 0xf0;      //!< spurious interrupt vector register
+    const uint32_t REG_ICR_LOW = 0x300;
+    const uint32_t REG_ICR_HIGH = 0x310;
+    const uint32_t REG_LVT_TIMER = 0x320;
+    const uint32_t REG_TIMER_INITIAL = 0x380;
+    const uint32_t REG_TIMER_CURRENT = 0x390;
+    const uint32_t REG_TIMER_DIVIDE = 0x3e0;
+
+    const uint32_t SVR_ENABLE = 1 << 8;
+
+    const uint32_t ICR_FIXED = 0 << 8;
+    const uint32_t ICR_INIT = 5 << 8;
+    const uint32_t ICR_STARTUP = 6 << 8;
+    const uint32_t ICR_PENDING = 1 << 12; //!< delivery status
+    const uint32_t ICR_ASSERT = 1 << 14;
+
+    const uint64_t ICR_TIMEOUT_US = 1000; //!< how long to wait for an IPI to be accepted
+
+    const uint32_t LVT_MASKED = 1 << 16;
+    const uint32_t LVT_PERIODIC = 1 << 17;
+    const uint32_t DIVIDE_BY_16 = 3;
+
+    const uint32_t CALIBRATION_MS = 10;
+}
+
+
+
+/* ====================================================================== */
+/** \brief maps the local APIC's registers
+    \param physical the physical address of the registers, from the MADT */
+void LocalAPIC::init(uint64_t physical)
+{
+    char *virt = PageTable::virt(physical);
+    bool ok = AddressSpace::kernel().map(virt, physical, Heap::PAGE_SIZE, PageTable::WRITABLE, MemoryType::UC);
+    assert(ok && "out of memory mapping the local APIC");
+    (void)ok;
+    registers = reinterpret_cast<volatile uint32_t *>(virt);
+}
+/** \brief enables the local APIC of the processor we're running on
+
+    This needs to be called on each processor.
+*/
+void LocalAPIC::enable(void)
+{
+    msr(MSR_APIC_BASE, msr(MSR_APIC_BASE) | APIC_BASE_ENABLE);
+    write(REG_SVR, read(REG_SVR) | SVR_ENABLE | Interrupt::SPURIOUS);
+}
+/** \brief sends an inter-processor interrupt
+    \param destination the APIC ID of the processor to send it to
+    \param command the low half of the ICR
+    \returns true if the interrupt was accepted */
+bool LocalAPIC::send(ID destination, uint32_t command)
+{
+    write(REG_ICR_HIGH, uint32_t(destination) << 24);
+    write(REG_ICR_LOW, command);
+    uint64_t deadline = TSC::now() + TSC::from_us(ICR_TIMEOUT_US);
+    while(read(REG_ICR_LOW) & ICR_PENDING)
+        if(TSC::now() > deadline)
+            return false;
+    return true;
+}
+/** \brief sends an INIT IPI, which resets a processor to wait for a
+    start-up IPI
+    \param destination the APIC ID of the processor
+    \returns true if the interrupt was accepted */
+bool LocalAPIC::send_init(ID destination)
+{
+    return send(destination, ICR_INIT | ICR_ASSERT);
+}
+/** \brief sends a start-up IPI (SIPI)
+    \param destination the APIC ID of the processor, which must be waiting
+    after an INIT IPI
+    \param vector the page number of the real mode code to start at
+    \returns true if the interrupt was accepted */
+bool LocalAPIC::send_startup(ID destination, uint8_t vector)
+{
+    return send(destination, ICR_STARTUP | ICR_ASSERT | vector);
+}
+/** \brief sends an interrupt to another processor
+    \param destination the APIC ID of the processor
+    \param vector the vector, which must have a handler on that processor
+    \returns true if the interrupt was accepted */
+bool LocalAPIC::send_interrupt(ID destination, Interrupt::Vector vector)
+{
+    return send(destination, ICR_FIXED | ICR_ASSERT | vector);
+}
+/** \brief measures the timer's frequency against the TSC, leaving it
+    stopped */
+void LocalAPIC::calibrate_timer(void)
+{
+    write(REG_LVT_TIMER, LVT_MASKED);
+    write(REG_TIMER_DIVIDE, DIVIDE_BY_16);
+    write(REG_TIMER_INITIAL, 0xffffffff);
+    TSC::delay(CALIBRATION_MS * 1000);
+    uint32_t elapsed = 0xffffffff - read(REG_TIMER_CURRENT);
+    write(REG_TIMER_INITIAL, 0);
+    timer_khz = elapsed / CALIBRATION_MS;
+}
+/** \brief starts the timer of the processor we're running on, interrupting
+    periodically
+    \param hz the number of interrupts per second
+    \returns false if there is no local APIC */
+bool LocalAPIC::start_timer(unsigned hz)
+{
+    if(!registers)
+        return false;
+    if(!timer_khz)
+        calibrate_timer();
+    Interrupt::set_handler(Interrupt::TIMER, tick);
+    uint32_t count = uint32_t(uint64_t(timer_khz) * 1000 / hz);
+    write(REG_TIMER_DIVIDE, DIVIDE_BY_16);
+    write(REG_LVT_TIMER, LVT_PERIODIC | Interrupt::TIMER);
+    write(REG_TIMER_INITIAL, count ? count : 1);
+    return true;
+}
+//! handles a timer interrupt
+void LocalAPIC::tick(Interrupt::Frame &)
+{
+    PerCPU::add(tick_count, uint64_t(1));
+}
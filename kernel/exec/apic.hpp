@@ -0,0 +1,58 @@
+// -*- mode: c++ -*-
+/**
+   \brief Local APIC (headers)
+   \file
+*/
+
+#ifndef EXEC_APIC_HPP
+#define EXEC_APIC_HPP
+
+/** \addtogroup exec_apic
+    @{ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "exec/interrupt.hpp"
+#include "exec/percpu.hpp"
+#include "exec/types.hpp"
+
+/** \brief each processor's local APIC, which sends and receives interrupts
+    (including inter-processor interrupts)
+
+    \note The registers are at the same physical address on every processor,
+    and each processor sees its own.
+*/
+class exec::LocalAPIC {
+public:
+    typedef uint8_t ID;         //!< an xAPIC ID
+private:
+    static volatile uint32_t *registers; //!< the memory-mapped registers
+    static uint32_t timer_khz;  //!< timer ticks per millisecond, or 0 if not calibrated
+    static uint64_t tick_count; //!< (per-processor) timer interrupts taken
+
+    //! reads a register
+    static uint32_t read(uint32_t reg) { return registers[reg / 4]; }
+    //! writes a register
+    static void write(uint32_t reg, uint32_t value) { registers[reg / 4] = value; }
+    static bool send(ID, uint32_t);
+    static void calibrate_timer(void);
+    static void tick(Interrupt::Frame &);
+public:
+    static void init(uint64_t);
+    static void enable(void);
+    //! \returns the ID of the processor we're running on
+    static ID id(void) { return ID(read(0x20) >> 24); }
+    static bool send_init(ID);
+    static bool send_startup(ID, uint8_t);
+    static bool send_interrupt(ID, Interrupt::Vector);
+    //! signals the end of the interrupt being handled
+    static void eoi(void) { write(0xb0, 0); }
+    static bool start_timer(unsigned);
+    //! \returns the number of timer interrupts this processor has taken
+    static uint64_t ticks(void) { return PerCPU::read(tick_count); }
+};
+
+/** @} */
+
+#endif
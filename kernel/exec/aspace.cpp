@@ -0,0 +1,408 @@
+// -*- mode: c++ -*-
+/**
+   \brief Address spaces (implementation)
+   \file
+*/
+
+#include <assert.h>
+#include <stddef.h>
+
+#include "exec/aspace.hpp"
+#include "exec/cpu.hpp"
+#include "exec/format.hpp"
+#include "exec/init.hpp"
+#include "exec/memory.hpp"
+#include "exec/pagetable.hpp"
+#include "exec/percpu.hpp"
+#include "exec/util.hpp"
+#include "exec/x86.hpp"
+
+using namespace exec;
+
+/** \defgroup exec_aspace AddressSpace: page tables and TLB tagging
+
+    Switching between address spaces is cheap only if it doesn't throw away
+    the TLB. Two processor features make that possible:
+
+    - Global pages (CR4.PGE). Kernel mappings are the same in every address
+      space, so they are marked global and survive a reload of %cr3.
+
+    - Process context identifiers (CR4.PCIDE). Each address space is tagged
+      with a 12 bit PCID, which is loaded into %cr3 along with the page
+      tables, and the TLB only uses entries tagged with the current PCID. With
+      the no-flush bit set, loading %cr3 then keeps the entries of every
+      address space, so switching back to a recently used one is nearly free.
+
+    PCIDs are assigned lazily, the first time an address space is activated.
+    Address space zero always has PCID 0. When the PCIDs run out, they are
+    recycled wholesale: the generation is incremented, the whole TLB is
+    flushed and every address space is given a new PCID the next time it's
+    activated. A PCID assigned since the last flush may still have stale
+    entries from a previous owner, so the first load of a new PCID doesn't
+    set the no-flush bit.
+
+    The identity map of low memory set up by Handover::__boot_init() shares
+    its page tables with the direct map, so it is removed before the kernel's
+    mappings are made global; otherwise user address spaces would see stale
+    global entries for low addresses. Once the kernel is running, its page
+    tables are moved out of the memory the bootloader allocated them from by
+    relocate(), so that the memory can be reclaimed.
+
+    Changes to the page tables (see PageTable) record the TLB invalidations
+    they need in a Flush, which makes them all at once when the operation is
+    complete. Up to Flush::MAX_PAGES pages are invalidated individually with
+    \c invlpg; beyond that it's cheaper to flush the whole TLB. Kernel
+    mappings are global, so \c invlpg invalidates them whichever address
+    space is active. User mappings in an address space that isn't active
+    can't be invalidated directly, so the address space is given a new PCID
+    instead.
+
+    The other processors only ever run in address space zero (see the \bug
+    on AddressSpace), so they only need to hear about changes to kernel
+    mappings and to address space zero. Flush::commit() shoots those down:
+    it leaves the Flush in Flush::request, sets a bit in Flush::targets for
+    each other online processor, sends each of them an
+    Interrupt::TLB_SHOOTDOWN IPI, and waits until they have all made the
+    invalidations and cleared their bits before freeing any released pages.
+    One processor shoots down at a time, and one waiting for its turn makes
+    any invalidations it's asked for meanwhile, so two can't deadlock even
+    with interrupts disabled.
+
+    @{
+*/
+
+//! a page awaiting release by Flush::commit(), stored in the page itself
+struct exec::AddressSpace::Flush::Deferred {
+    Deferred *next;             //!< next page to release
+    unsigned shift;             //!< log2 of the size of the page
+};
+
+bool AddressSpace::pcid_enabled = false;
+uint32_t AddressSpace::generation = 1;
+AddressSpace::PCID AddressSpace::next_pcid = 1;
+uint64_t AddressSpace::pcid_used[AddressSpace::PCID_COUNT / 64];
+AddressSpace AddressSpace::kernel_space(0);
+AddressSpace *AddressSpace::current_space EXEC_PERCPU = &AddressSpace::kernel_space;
+const AddressSpace::Flush *AddressSpace::Flush::request = NULL;
+uint32_t AddressSpace::Flush::targets = 0;
+bool AddressSpace::Flush::sending = false;
+
+/** @} */
+
+namespace {
+    const uintptr_t CR4_PGE = 1 << 7;
+    const uintptr_t CR4_PCIDE = 1 << 17;
+    const uint64_t CR3_NOFLUSH = uint64_t(1) << 63;
+
+    const uint32_t CPUID_ECX_PCID = 1 << 17;
+
+    uint64_t *entry_to_table(uint64_t entry)
+    {
+        return reinterpret_cast<uint64_t *>(PageTable::virt(entry & PageTable::ADDRESS));
+    }
+
+    /** \brief sets the global bit on every page mapped by a table
+        \param table the table
+        \param level the level of the table (4 for the PML4, 1 for a page table)
+        \param first the first entry to consider */
+    EXEC_INIT void mark_global(uint64_t *table, unsigned level, size_t first = 0)
+    {
+        for(size_t i = first; i < 512; ++i) {
+            uint64_t &entry = table[i];
+            if(!(entry & PageTable::PRESENT))
+                continue;
+            if(level == 1 || (level < 4 && (entry & PageTable::LARGE)))
+                entry |= PageTable::GLOBAL;
+            else
+                mark_global(entry_to_table(entry), level - 1);
+        }
+    }
+
+    //! flushes the entire TLB, including global entries and all PCIDs
+    void flush_all(void)
+    {
+        uintptr_t value = cr4();
+        cr4(value & ~CR4_PGE);
+        cr4(value);
+    }
+}
+
+
+
+/* ====================================================================== */
+//! takes over the page tables set up by the bootloader as address space zero
+EXEC_INIT void AddressSpace::init(void)
+{
+    kernel_space.l4 = cr3() & PageTable::ADDRESS;
+    kernel_space.pcid = KERNEL_PCID;
+    kernel_space.pcid_generation = generation;
+    pcid_used[0] = 1;           // PCID 0 belongs to the kernel
+    PageTable::init();
+}
+/** \brief enables global pages and PCIDs
+
+    This must be called on the kernel's own stack, as it removes the identity
+    map of low memory.
+*/
+EXEC_INIT void AddressSpace::init_tlb(void)
+{
+    uint64_t *pml4 = entry_to_table(kernel_space.l4);
+    pml4[0] = 0;
+    mark_global(pml4, 4, 256);
+
+    uint32_t regs[4];
+    cpuid(1, 0, regs);
+    pcid_enabled = regs[2] & CPUID_ECX_PCID;
+
+    // setting PGE flushes the TLB, including the identity map we just removed
+    init_cpu();
+}
+/** \brief enables global pages and (if the first processor could) PCIDs on
+    the processor we're running on, and makes address space zero current
+
+    init_tlb() does this for the first processor. The others are already
+    using address space zero, but with PCID 0, as they must be to enable
+    PCIDs.
+*/
+void AddressSpace::init_cpu(void)
+{
+    cr4(cr4() | CR4_PGE | (pcid_enabled ? CR4_PCIDE : 0));
+    PerCPU::write(current_space, &kernel_space);
+}
+//! handles TLB shootdowns from other processors, which must be done before they start
+void AddressSpace::init_shootdown(void)
+{
+    static_assert(CPU::MAX_CPUS <= 32, "Flush::targets has a bit per processor");
+    Interrupt::set_handler(Interrupt::TLB_SHOOTDOWN, Flush::interrupt);
+}
+/** \brief moves this (active) address space's page tables into memory
+    allocated from the Heap
+
+    The PML4 is kept below 4GiB, so that it can be loaded into %cr3 by 32 bit
+    code. The old tables are left as they were, for the caller to free.
+*/
+void AddressSpace::relocate(void)
+{
+    assert(this == &current() && "relocating an inactive address space");
+    l4 = PageTable(l4).copy(Heap::REQ_DMA32);
+    cr3(uintptr_t(l4 | (pcid_enabled ? pcid : 0)));
+    // the paging-structure caches may still point at the old tables
+    flush_all();
+}
+AddressSpace::~AddressSpace()
+{
+    assert(this != &current() && "destroying the active address space");
+    retire_pcid();
+}
+/** \brief assigns a PCID that isn't in use in the current generation,
+    recycling all of them if there are none left */
+void AddressSpace::assign_pcid(void)
+{
+    for(size_t tries = 0; tries < 2; ++tries) {
+        for(size_t i = 0; i < PCID_COUNT; ++i) {
+            PCID candidate = PCID((next_pcid + i) % PCID_COUNT);
+            uint64_t bit = uint64_t(1) << (candidate % 64);
+            if(pcid_used[candidate / 64] & bit)
+                continue;
+            pcid_used[candidate / 64] |= bit;
+            next_pcid = PCID((candidate + 1) % PCID_COUNT);
+            pcid = candidate;
+            pcid_generation = generation;
+            return;
+        }
+
+        // they're all in use, so start a new generation
+        ++generation;
+        for(size_t i = 0; i < PCID_COUNT / 64; ++i)
+            pcid_used[i] = 0;
+        pcid_used[0] = 1;
+        kernel_space.pcid_generation = generation;
+        next_pcid = 1;
+        flush_all();
+    }
+    assert(!"no PCID available after recycling");
+}
+/** \brief gives up this address space's PCID, so that it gets a new one
+    (with no stale TLB entries) when it's next activated */
+void AddressSpace::retire_pcid(void)
+{
+    if(pcid != NO_PCID && pcid != KERNEL_PCID && pcid_generation == generation)
+        pcid_used[pcid / 64] &= ~(uint64_t(1) << (pcid % 64));
+    pcid = NO_PCID;
+    pcid_generation = 0;
+}
+/** \brief loads this address space into %cr3
+
+    The TLB is only flushed if PCIDs aren't supported, or this address space
+    has just been assigned a PCID that may have stale entries.
+*/
+void AddressSpace::activate(void)
+{
+    uint64_t value = l4;
+    if(pcid_enabled) {
+        if(pcid_generation == generation) {
+            value |= pcid | CR3_NOFLUSH;
+        } else {
+            assign_pcid();
+            value |= pcid;
+        }
+    }
+    cr3(uintptr_t(value));
+    PerCPU::write(current_space, this);
+}
+/** \brief maps a range of physical memory
+    \param address the page-aligned virtual address to map at
+    \param physical the page-aligned physical address to map
+    \param length the length of the range, a multiple of the page size
+    \param flags PageTable::WRITABLE and/or PageTable::USER
+    \param type the memory type
+    \returns true on success, or false if page tables couldn't be allocated
+    (in which case part of the range may be mapped) */
+bool AddressSpace::map(char *address, uint64_t physical, size_t length, uint64_t flags, MemoryType::Type type)
+{
+    Flush flush(*this);
+    return PageTable(l4).map(address, physical, length, flags, type, flush);
+}
+/** \brief unmaps a range of virtual memory
+    \param address the page-aligned start of the range
+    \param length the length of the range, a multiple of the page size
+    \param release whether to free the mapped pages to the Heap */
+void AddressSpace::unmap(char *address, size_t length, bool release)
+{
+    Flush flush(*this);
+    PageTable(l4).unmap(address, length, release, flush);
+}
+/** \brief changes the permissions of a range of virtual memory
+    \param address the page-aligned start of the range
+    \param length the length of the range, a multiple of the page size
+    \param flags the new PageTable::WRITABLE and PageTable::USER bits
+    \returns true on success, or false if a large page couldn't be split */
+bool AddressSpace::protect(char *address, size_t length, uint64_t flags)
+{
+    Flush flush(*this);
+    return PageTable(l4).protect(address, length, flags, flush);
+}
+void AddressSpace::dump(Formatter &formatter)
+{
+    size_t used = 0;
+    for(size_t i = 0; i < PCID_COUNT / 64; ++i)
+        for(uint64_t bits = pcid_used[i]; bits; bits &= bits - 1)
+            ++used;             // the kernel isn't linked with libgcc's popcount
+    EXEC_FORMAT(formatter, "AddressSpace: PCIDs %s, generation %u, %zd of %zd in use\n",
+              pcid_enabled ? "enabled" : "not supported", generation, used, PCID_COUNT);
+    EXEC_FORMAT(formatter, "  current: PML4 %#'llx PCID %u\n",
+              current().l4, unsigned(current().pcid));
+}
+
+
+
+/* ====================================================================== */
+//! records that the TLB entry for a page must be invalidated
+void AddressSpace::Flush::add(const char *address)
+{
+    if(PageTable::is_kernel(address))
+        kernel = true;
+    else
+        user = true;
+    if(count < MAX_PAGES)
+        pages[count++] = address;
+    else
+        all = true;
+}
+/** \brief frees a page once the TLB no longer refers to it
+    \param page the direct-mapped address of the page
+    \param shift log2 of the size of the page */
+void AddressSpace::Flush::release(char *page, unsigned shift)
+{
+    Deferred *d = reinterpret_cast<Deferred *>(page);
+    d->next = deferred;
+    d->shift = shift;
+    deferred = d;
+}
+//! makes the recorded invalidations, and frees the released pages
+void AddressSpace::Flush::commit(void)
+{
+    bool current = &space == &AddressSpace::current();
+    if(all) {
+        if(kernel)
+            flush_all();
+        else if(current)
+            cr3(cr3());         // flushes the current PCID's non-global entries
+    } else {
+        for(size_t i = 0; i < count; ++i)
+            if(current || PageTable::is_kernel(pages[i]))
+                invlpg(pages[i]);
+    }
+    if(user && !current && pcid_enabled)
+        space.retire_pcid();
+    if(kernel || &space == &kernel_space)
+        shoot_down();
+
+    while(Deferred *d = deferred) {
+        deferred = d->next;
+        char *page = reinterpret_cast<char *>(d);
+        Heap::Order order = d->shift - Heap::PAGE_SHIFT;
+        // pages larger than the Heap's largest block are freed in pieces
+        for(size_t pages_left = size_t(1) << order; pages_left; ) {
+            Heap::Order piece = min(order, Heap::ORDER_COUNT - 1);
+            Heap::free_pages(page, piece);
+            page += Heap::PAGE_SIZE << piece;
+            pages_left -= size_t(1) << piece;
+        }
+    }
+
+    count = 0;
+    all = kernel = user = false;
+}
+/** \brief makes the invalidations on every other online processor, waiting
+    until they have */
+void AddressSpace::Flush::shoot_down(void) const
+{
+    CPU::ID self = CPU::current();
+    uint32_t others = 0;
+    for(CPU::ID id = 0; id < CPU::count(); ++id)
+        if(id != self && CPU::is_online(id))
+            others |= uint32_t(1) << id;
+    if(!others)
+        return;
+
+    while(__atomic_exchange_n(&sending, true, __ATOMIC_ACQUIRE)) {
+        serve();
+        asm volatile("pause");
+    }
+    request = this;
+    __atomic_store_n(&targets, others, __ATOMIC_RELEASE);
+    for(CPU::ID id = 0; id < CPU::count(); ++id)
+        if(others & (uint32_t(1) << id)) {
+            bool sent = CPU::interrupt(id, Interrupt::TLB_SHOOTDOWN);
+            assert(sent && "TLB shootdown IPI not accepted");
+            (void)sent;
+        }
+    while(__atomic_load_n(&targets, __ATOMIC_ACQUIRE))
+        asm volatile("pause");
+    __atomic_store_n(&sending, false, __ATOMIC_RELEASE);
+}
+/** \brief makes the invalidations in #request if this processor is one of
+    its #targets
+
+    This processor is running in address space zero, so every page in it
+    can be invalidated with \c invlpg. */
+void AddressSpace::Flush::serve(void)
+{
+    uint32_t bit = uint32_t(1) << CPU::current();
+    if(!(__atomic_load_n(&targets, __ATOMIC_ACQUIRE) & bit))
+        return;
+    const Flush *flush = request;
+    if(flush->all)
+        flush_all();
+    else
+        for(size_t i = 0; i < flush->count; ++i)
+            if(&flush->space == &kernel_space || PageTable::is_kernel(flush->pages[i]))
+                invlpg(flush->pages[i]);
+    __atomic_fetch_and(&targets, ~bit, __ATOMIC_RELEASE);
+}
+//! handles Interrupt::TLB_SHOOTDOWN
+void AddressSpace::Flush::interrupt(Interrupt::Frame &)
+{
+    serve();
+}
@@ -0,0 +1,122 @@
+// -*- mode: c++ -*-
+/**
+   \brief Address spaces (headers)
+   \file
+*/
+
+#ifndef EXEC_ASPACE_HPP
+#define EXEC_ASPACE_HPP
+
+/** \addtogroup exec_aspace
+    @{ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "exec/interrupt.hpp"
+#include "exec/memtype.hpp"
+#include "exec/percpu.hpp"
+#include "exec/types.hpp"
+
+/** \brief a set of page tables, and the processor context identifier (PCID)
+    which tags its TLB entries
+
+    \bug PCIDs are tagged per processor, but the allocator is global and
+    unlocked, so only one processor may switch address spaces.
+*/
+class exec::AddressSpace {
+public:
+    class Flush;
+    typedef uint16_t PCID;
+    static const PCID KERNEL_PCID = 0;      //!< PCID of address space zero
+    static const PCID NO_PCID = 0xffff;     //!< not (yet) assigned a PCID
+    static const size_t PCID_COUNT = 4096;  //!< number of PCIDs the processor supports
+private:
+    static bool pcid_enabled;   //!< whether CR4.PCIDE is set
+    static uint32_t generation; //!< incremented whenever the PCIDs are recycled
+    static PCID next_pcid;      //!< where to start looking for a free PCID
+    static uint64_t pcid_used[PCID_COUNT / 64]; //!< bitmap of assigned PCIDs
+    static AddressSpace kernel_space; //!< address space zero
+    static AddressSpace *current_space; //!< (per-processor) the active address space
+
+    uint64_t l4;                //!< physical address of the PML4
+    PCID pcid;                  //!< this address space's PCID
+    uint32_t pcid_generation;   //!< #generation when #pcid was assigned
+
+    void assign_pcid(void);
+    void retire_pcid(void);
+public:
+    /** \brief constructs an address space
+        \param l4_ the physical address of the PML4 */
+    constexpr AddressSpace(uint64_t l4_)
+        : l4(l4_), pcid(NO_PCID), pcid_generation(0)
+    {}
+    AddressSpace(const AddressSpace &) = delete;            //!< **deleted**
+    AddressSpace &operator=(const AddressSpace &) = delete; //!< **deleted**
+    ~AddressSpace();
+
+    static void init(void);
+    static void init_tlb(void);
+    static void init_cpu(void);
+    static void init_shootdown(void);
+    //! \returns address space zero, which holds only kernel mappings
+    static AddressSpace &kernel(void) { return kernel_space; }
+    //! \returns the address space currently loaded into %cr3
+    static AddressSpace &current(void) { return *PerCPU::read(current_space); }
+    //! \returns the physical address of the PML4
+    uint64_t root(void) const { return l4; }
+    void activate(void);
+    void relocate(void);
+    bool map(char *, uint64_t, size_t, uint64_t, MemoryType::Type=MemoryType::WB);
+    void unmap(char *, size_t, bool=false);
+    bool protect(char *, size_t, uint64_t);
+    static void dump(Formatter &);
+};
+
+/** \brief the TLB invalidations needed by a page table operation
+
+    Invalidations are gathered as page table entries are changed and made
+    in one go by commit() (or the destructor), which is also when any pages
+    released by the operation are freed, as until then the TLB might still
+    refer to them. Invalidations that other processors need are shot down
+    to them by an IPI, and commit() waits until they have made them.
+*/
+class exec::AddressSpace::Flush {
+    struct Deferred;
+
+    //! above this many pages, the whole TLB is flushed rather than each page
+    static const size_t MAX_PAGES = 32;
+
+    static const Flush *request; //!< the invalidations being shot down
+    static uint32_t targets;    //!< processors yet to make #request's invalidations, a bit each
+    static bool sending;        //!< whether a processor is shooting down invalidations
+
+    AddressSpace &space;        //!< the address space whose tables changed
+    const char *pages[MAX_PAGES]; //!< pages to invalidate
+    size_t count;               //!< number of entries in #pages
+    bool all;                   //!< flush everything instead of #pages
+    bool kernel;                //!< some of the pages are kernel (global) mappings
+    bool user;                  //!< some of the pages are user mappings
+    Deferred *deferred;         //!< pages to be freed after the flush
+
+    void shoot_down(void) const;
+    static void serve(void);
+    static void interrupt(Interrupt::Frame &);
+    friend class AddressSpace;
+public:
+    //! constructs an empty set of invalidations for an address space
+    explicit Flush(AddressSpace &space_)
+        : space(space_), pages(), count(0), all(false), kernel(false), user(false), deferred(NULL)
+    {}
+    Flush(const Flush &) = delete;            //!< **deleted**
+    Flush &operator=(const Flush &) = delete; //!< **deleted**
+    ~Flush() { commit(); }
+
+    void add(const char *);
+    void release(char *, unsigned);
+    void commit(void);
+};
+
+/** @} */
+
+#endif
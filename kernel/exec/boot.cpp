@@ -5,89 +5,14 @@
 
 #include "exec/format.hpp"
 #include "exec/handover.hpp"
-#include "exec/memory.hpp"
-#include "exec/memory_priv.hpp"
+#include "exec/memblock.hpp"
+#include "exec/memtype.hpp"
+#include "exec/serial.hpp"
 #include "exec/util.hpp"
 #include "exec/vararray.hpp"
+#include "exec/x86.hpp"
 using namespace exec;
 
-inline void outb(uint16_t p, uint8_t a)
-{
-    asm volatile("outb %0, %w1" : : "a"(a), "Nd"(p));
-}
-inline uint8_t inb(uint16_t p) 
-{
-    uint8_t a;
-    asm volatile("inb %w1, %0" : "=a"(a) : "Nd"(p));
-    return a;
-}
-inline void outw(uint16_t p, uint16_t a)
-{
-    asm volatile("outw %w0, %w1" : : "a"(a), "Nd"(p));
-}
-inline void outw(uint16_t p, uint8_t al, uint8_t ah)
-{
-    asm volatile("outw %w0, %w1" : : "a"(al + 256 * ah), "Nd"(p));
-}
-inline uint16_t inw(uint16_t p) 
-{
-    uint16_t a;
-    asm volatile("inw %w1, %w0" : "=a"(a) : "Nd"(p));
-    return a;
-}
-inline void outl(uint16_t p, uint32_t a)
-{
-    asm volatile("outl %0, %w1" : : "a"(a), "Nd"(p));
-}
-inline uint32_t inl(uint16_t p) 
-{
-    uint32_t a;
-    asm volatile("inl %w1, %0" : "=a"(a) : "Nd"(p));
-    return a;
-}
-
-inline void cr3(uintptr_t value) {
-    asm volatile("movl %0, %%cr3" : : "r"(value));
-}
-
-inline void cr4(uint32_t value) {
-    asm volatile("movl %0, %%cr4" : : "r"(value));
-}
-
-inline uint32_t cr4(void) {
-    uint32_t ret;
-    asm volatile("movl %%cr4, %0" : "=r"(ret) : );
-    return ret;
-}
-
-inline void cr0(uint32_t value) {
-    asm volatile("movl %0, %%cr0" : : "r"(value));
-}
-
-inline uint32_t cr0(void) {
-    uint32_t ret;
-    asm volatile("movl %%cr0, %0" : "=r"(ret) : );
-    return ret;
-}
-
-inline void msr(uint32_t msr, uint64_t value) {
-    uint32_t eax = uint32_t(value), edx = uint32_t(value >> 32);
-    asm volatile("wrmsr\n"
-                 :
-                 : "a"(eax), "d"(edx), "c"(msr)
-        );
-}
-
-inline uint64_t msr(uint32_t msr) {
-    uint32_t eax, edx;
-    asm volatile(
-        "rdmsr\n"
-        : "=a"(eax), "=d"(edx)
-        : "c"(msr)
-        );
-    return uint64_t(eax) | (uint64_t(edx) << 32);
-}
-
 /** \brief Data structures passed by a Multiboot-compatible boot loader. \bug fixme
 
     Multiboot is an interface specification which removes the tight binding
@@ -144,13 +69,12 @@ struct exec::Handover::Multiboot {
     /** \brief A loaded kernel module.
 
      */
-    struct Module;
-    // struct Module {
-    //     char *start;            //!< start address of module
-    //     char *end;              //!< one-past-end address of module
-    //     const char *cmdline;    //!< module command line (might be NULL)
-    //     uint32_t reserved;      //!< for future expansion (must be 0)
-    // };
+    struct Module {
+        char *start;            //!< start address of module
+        char *end;              //!< one-past-end address of module
+        const char *cmdline;    //!< module command line (might be NULL)
+        uint32_t reserved;      //!< for future expansion (must be 0)
+    };
 
     uint32_t modules_count; //!< the number of kernel modules (if FLAG_MODS set)
     Module *modules;      //!< the kernel module descriptors (if FLAG_MODS set)
@@ -217,42 +141,6 @@ public:
 
 namespace {
 
-struct Serial
-{
-    static const uint16_t COM1 = 0x3f8;
-    uint16_t port;
-    // outputs a single character to the serial port
-    void putc(char c)
-    {
-        if(c == '\n') putc('\r');
-        while (!(inb(port|5) & 0x20));
-        outb(port, c);
-    }
-    Serial(uint16_t port_=COM1, unsigned speed = 9600)
-        : port(port_)
-    {
-        size_t divisor = 115200 / speed;
-        if(divisor == 0) {
-            divisor = 1;
-        } else if(divisor > 0xffff) {
-            divisor = 0xffff;
-        }
-
-        // for port assignments, see e.g. http://www.lammertbies.nl/comm/info/serial-uart.html
-
-        outb(port|3, 0);          // Set DLAB = 0 (ports 0+1 are data / interrupt registers)
-        outb(port|1, 0);          // Disable all interrupts
-
-        outb(port|3, 0x80);       // Set DLAB = 1 (ports 0+1 are divisor)
-        outw(port|0, uint16_t(divisor));
-
-        outb(port|3, 0x03);       // 8 bits, no parity, one stop bit
-        outb(port|2, 0xC7);  // Enable FIFO, clear them, with 14-byte threshold
-        outb(port|4, 0x0B);  // IRQs enabled, RTS/DSR set
-
-    }
-};
-
 struct VGA
 {
     struct vga_cell_t {
@@ -277,7 +165,7 @@ struct VGA
     }
     void scroll()
     {
-        for(size_t iy = 0; iy < columns; ++iy) {
+        for(size_t iy = 1; iy < rows; ++iy) {
             vga_cell_t *to = fb + (iy-1) * columns,
                 * from = fb + iy * columns;
             for(size_t ix = 0; ix < columns; ++ix) {
@@ -363,25 +251,191 @@ void kprintf(const char *format, ...)
     va_end(args);
 }
 
+namespace {
+
+/** \brief the bootloader's memory allocator
+
+    Everything the bootloader allocates is handed over to the kernel, so it
+    is kept within the ISA zone, which the kernel doesn't release until it
+    has finished with the boot data.
+*/
+Memblock memblock;
+const Memblock::Address BOOT_LIMIT = 16 << 20;
+
+void *boot_allocate(size_t size, size_t alignment)
+{
+    Memblock::Address allocation = memblock.allocate(size, alignment, BOOT_LIMIT);
+    assert(allocation && "out of boot memory");
+    return reinterpret_cast<void *>(uintptr_t(allocation));
+}
+
+const uint64_t PAGE_PRESENT = 1 << 0;
+const uint64_t PAGE_WRITABLE = 1 << 1;
+const uint64_t PAGE_LARGE = 1 << 7;
+
+//! allocates a zeroed page table with the given number of entries
+uint64_t *allocate_table(size_t entries)
+{
+    uint64_t *table = static_cast<uint64_t *>(boot_allocate(entries * sizeof(uint64_t), 4096));
+    for(size_t i = 0; i < entries; ++i)
+        table[i] = 0;
+    return table;
+}
+
+//! \returns true if the processor supports 1GB pages
+bool has_gigabyte_pages(void)
+{
+    uint32_t regs[4];
+    cpuid(0x80000000, 0, regs);
+    if(regs[0] < 0x80000001)
+        return false;
+    cpuid(0x80000001, 0, regs);
+    return regs[3] & (1 << 26);
+}
+
+/** \brief picks the type to map a range of physical memory with
+
+    This honours the MTRRs, except in the legacy hole at [640KB, 1MB) which
+    is never RAM: the VGA text buffer there is write-combined and the rest is
+    UC.
+
+    \returns the type, or MemoryType::MIXED if the range needs to be split
+    into smaller pages
+*/
+MemoryType::Type map_type(uint64_t begin, uint64_t end)
+{
+    static const uint64_t
+        hole_begin = 0xa0000, hole_end = 0x100000,
+        vga_begin = 0xb8000, vga_end = 0xc0000;
+    if(begin < hole_end && end > hole_begin) {
+        if(begin < hole_begin || end > hole_end)
+            return MemoryType::MIXED;
+        if(begin >= vga_begin && end <= vga_end)
+            return MemoryType::WC;
+        if(begin < vga_end && end > vga_begin)
+            return MemoryType::MIXED;
+        MemoryType::Type type = MemoryType::mtrr(begin, end);
+        return type == MemoryType::WB ? MemoryType::UC : type;
+    }
+    return MemoryType::mtrr(begin, end);
+}
+
+//! gets the table an entry points to, allocating a new one if it's not present
+uint64_t *next_table(uint64_t &entry)
+{
+    if(!(entry & PAGE_PRESENT))
+        entry = uint64_t(allocate_table(512)) | PAGE_PRESENT | PAGE_WRITABLE;
+    assert(!(entry & PAGE_LARGE));
+    return reinterpret_cast<uint64_t *>(uintptr_t(entry & ~uint64_t(0xfff)));
+}
+
+/** \brief maps a range of physical memory
+
+    The range is mapped at the same offset within the 512GB covered by the
+    Page Directory Pointer table, using the largest pages that fit the range
+    and have the same memory type throughout.
+
+    \param l3 the Page Directory Pointer table
+    \param begin the start of the range, which must be page-aligned
+    \param end one-past-end of the range, which must be page-aligned
+    \param gigabyte_pages whether 1GB pages are supported
+*/
+void map_range(uint64_t *l3, uint64_t begin, uint64_t end, bool gigabyte_pages)
+{
+    static const uint64_t
+        size1 = 1 << 12, size2 = 1 << 21, size3 = 1 << 30;
+    uint64_t address = begin;
+    while(address < end) {
+        uint64_t &l3e = l3[(address >> 30) & 511];
+        MemoryType::Type type;
+        if(
+            gigabyte_pages && !(address & (size3 - 1)) && address + size3 <= end
+            && (type = map_type(address, address + size3)) != MemoryType::MIXED
+            ) {
+            l3e = address | PAGE_PRESENT | PAGE_WRITABLE | PAGE_LARGE | MemoryType::pte_flags(type, true);
+            address += size3;
+            continue;
+        }
+        uint64_t &l2e = next_table(l3e)[(address >> 21) & 511];
+        if(
+            !(address & (size2 - 1)) && address + size2 <= end
+            && (type = map_type(address, address + size2)) != MemoryType::MIXED
+            ) {
+            l2e = address | PAGE_PRESENT | PAGE_WRITABLE | PAGE_LARGE | MemoryType::pte_flags(type, true);
+            address += size2;
+            continue;
+        }
+        type = map_type(address, address + size1);
+        if(type == MemoryType::MIXED)
+            type = MemoryType::UC;
+        next_table(l2e)[(address >> 12) & 511] =
+            address | PAGE_PRESENT | PAGE_WRITABLE | MemoryType::pte_flags(type, false);
+        address += size1;
+    }
+}
+
+//! the physical memory to be mapped (reservations are unused)
+Memblock mappable;
+
+/** \brief the header at the start of kernel.bin; see kernel_entry.S
+
+    \note the addresses are the kernel's 64 bit virtual addresses.
+*/
+struct KernelHeader {
+    uint64_t entry;             //!< the entry point
+    uint64_t start;             //!< the link address of the image
+    uint64_t data_end;          //!< one-past-end of the image (page-aligned)
+    uint64_t bss_end;           //!< one-past-end of the BSS
+};
+
+/** \brief maps the kernel at its link address with 4KB pages
+
+    The image is mapped where it was loaded, as part of the bootloader, and
+    freshly allocated pages are mapped after it for the BSS, which the kernel
+    clears itself.
+
+    \param l3 the Page Directory Pointer table for the top 512GB
+    \param header the kernel's header, where it was loaded
+*/
+void map_kernel(uint64_t *l3, const KernelHeader *header)
+{
+    uint64_t
+        image_size = header->data_end - header->start,
+        bss_size = round_up(header->bss_end - header->data_end, uint64_t(4096)),
+        image = uintptr_t(header),
+        bss = uintptr_t(boot_allocate(size_t(bss_size), 4096));
+    assert(!(image & 4095) && !(image_size & 4095) && "kernel image not page-aligned");
+    for(uint64_t offset = 0; offset < image_size + bss_size; offset += 4096) {
+        uint64_t
+            address = header->start + offset,
+            physical = offset < image_size ? image + offset : bss + offset - image_size;
+        uint64_t *l2 = next_table(l3[(address >> 30) & 511]);
+        uint64_t *l1 = next_table(l2[(address >> 21) & 511]);
+        l1[(address >> 12) & 511] = physical | PAGE_PRESENT | PAGE_WRITABLE
+            | MemoryType::pte_flags(MemoryType::WB, false);
+    }
+}
+
+}
+
 void *operator new(size_t size)
 {
-    void *allocation = Heap::allocate_bytes(size);
+    void *allocation = boot_allocate(size, 16);
     kprintf("operator new(%d) = %p\n", size, allocation);
     return allocation;
 }
-void operator delete(void *ptr)
+void operator delete(void *)
 {
-    Heap::free_bytes(reinterpret_cast<char *>(ptr));
+    // the bootloader never frees anything, and Memblock needs to know the size
 }
 void *operator new[](size_t size)
 {
-    void *allocation = Heap::allocate_bytes(size);
+    void *allocation = boot_allocate(size, 16);
     kprintf("operator new[](%d) = %p\n", size, allocation);
     return allocation;
 }
-void operator delete[](void *ptr)
+void operator delete[](void *)
 {
-    Heap::free_bytes(reinterpret_cast<char *>(ptr));
 }
 
 extern "C" void __cxa_pure_virtual(void)
@@ -459,29 +513,22 @@ void Handover::Multiboot::dump(Formatter &formatter) const
 }
 
 
-extern "C" char __boot_scratch, __boot_scratch_end;
+extern "C" char __boot_start, __boot_end;
+//! the kernel image, which starts with its KernelHeader
+extern "C" char __kernel_start[];
+//! time stamp counter at __boot_start, set by boot_entry.S
+extern "C" { uint64_t __boot_start_tsc; }
 
 Handover::Handover(const Multiboot &multiboot)
     : e820_zones(__null), e820_zone_count(0) // we don't yet know what these will contain
+    , boot_start_tsc(__boot_start_tsc), boot_init_tsc(0)
 {
-    static const uint64_t sixteen_meg = 16 << 20;
+    // the map is passed on as the firmware gave it, and normalised by the
+    // kernel's Memblock::add_e820()
     if(multiboot.flags & Multiboot::FLAG_MEM_MAP) {
-        e820_zones = new Handover::E820[e820_zone_count + 1];
-        Multiboot::e820_iterator_t
-            zone = multiboot.e820.begin(),
-            end = multiboot.e820.end();
-        while(zone != end) {
-            uint64_t
-                zone_begin = zone->base,
-                zone_end = zone_begin + zone->length;
-            if(zone_begin < sixteen_meg && sixteen_meg < zone_end) {
-                e820_zones[e820_zone_count++] = E820(zone_begin, sixteen_meg - zone_begin);
-                e820_zones[e820_zone_count++] = E820(sixteen_meg, zone_end - sixteen_meg);
-                ++zone;
-            } else {
-                e820_zones[e820_zone_count++] = *zone++;
-            }
-        }
+        e820_zones = new Handover::E820[multiboot.e820.count()];
+        for(Multiboot::e820_iterator_t zone = multiboot.e820.begin(); zone != multiboot.e820.end(); ++zone)
+            e820_zones[e820_zone_count++] = *zone;
     } else {
         e820_zone_count = 2;
         e820_zones = new E820[e820_zone_count];
@@ -492,71 +539,105 @@ Handover::Handover(const Multiboot &multiboot)
 
 Handover *Handover::__boot_init(const Multiboot *multiboot)
 {
+    uint64_t init_tsc = rdtsc();
     SerialFormatter _console;
     console = &_console;
     kprintf("masala86: first-state bootloader starting up...\n");
     multiboot->dump(_console);
 
-    Heap::Init init(&__boot_scratch, &__boot_scratch_end, &__boot_scratch, 1);
-    Heap::Impl::create(init);
-    Heap::PFN
-        pfn_begin = init.pfn(round_up(init.alloc_end, Heap::PAGE_SIZE)),
-        pfn_end = init.pfn(&__boot_scratch_end);
-    Heap::Zone *zone = new (init.next_zone()) Heap::Zone(
-        "Bootstrap", 0, pfn_begin, pfn_end, Heap::REQ_ANY
-    );
-    Heap::heap->zones.enqueue(zone);
-    Heap::heap->release_range(pfn_begin, pfn_end);
-    //Heap::dump(_console);
+    // seed the allocator with the RAM from the memory map, then reserve
+    // everything that's already in use: the first 1MiB (IVT, BIOS data area,
+    // EBDA, ROMs), ourselves (including the kernel image and the boot stack),
+    // the Multiboot structures and any modules.
+    if(multiboot->flags & Multiboot::FLAG_MEM_MAP) {
+        memblock.add_e820(multiboot->e820.begin(), multiboot->e820.end());
+    } else {
+        memblock.add(0, multiboot->mem_lower << 10U);
+        memblock.add(1 << 20, (1 << 20) + (uint64_t(multiboot->mem_upper) << 10U));
+    }
+    memblock.reserve(0, 1 << 20);
+    memblock.reserve(uintptr_t(&__boot_start), uintptr_t(&__boot_end));
+    memblock.reserve(uintptr_t(multiboot), uintptr_t(multiboot + 1));
+    if(multiboot->flags & Multiboot::FLAG_MEM_MAP)
+        memblock.reserve(
+            uintptr_t(multiboot->e820.address()),
+            uintptr_t(multiboot->e820.address()) + multiboot->e820.length()
+            );
+    /// \bug modules are kept safe from the bootloader, but not passed on to the kernel
+    if(multiboot->flags & Multiboot::FLAG_MODS) {
+        memblock.reserve(
+            uintptr_t(multiboot->modules),
+            uintptr_t(multiboot->modules + multiboot->modules_count)
+            );
+        for(uint32_t i = 0; i < multiboot->modules_count; ++i)
+            memblock.reserve(uintptr_t(multiboot->modules[i].start), uintptr_t(multiboot->modules[i].end));
+    }
 
     /*
       We now need to set up some page tables as follows:
 
-      Identity-map the first 512GB so that we can still execute code before
+      Identity-map physical memory so that we can still execute code before
       transferring control to higher-half addresses.
 
-      Similarly, map the first 2GB to the last 2GB (i.e. to
-      0xffffffff_08000000) so the higher-half kernel can be executed at its
-      link address (0xffffffff_81000000).
+      Map the kernel image, wherever it was loaded, at its link address
+      (0xffffffff_81000000) so that it can run in place.
+
+      Map physical memory to 0xffff8000_00000000) which is the lowest
+      canonical higher-half address available so that the memory allocator
+      can set up a heap.
 
-      Map the first 512GB to 0xffff8000_00000000) which is the lowest canonical
-      higher-half address available so that the memory allocator can set up a
-      heap.
+      Only the first 1MB (for the legacy hole and the BIOS) and the memory
+      areas in the E820 map that hold RAM or ACPI tables are mapped, so
+      tables aren't wasted on non-existent memory and MMIO holes aren't
+      exposed as cacheable RAM. Devices that need them map their own
+      registers.
 
     */
 
-    // start by creating four contiguous level 2 (Page Directory) tables that
-    // map each 2MB of the first 512GB of physical addresses. (They're only
-    // contiguous for convenience in initialisating them.)
-    size_t entries = (512 * 1024) / 2; // number of 2MB pages in 512GB
-    uint64_t *l2 = new uint64_t[entries];
-    for(uint64_t i = 0; i < entries; ++i) {
-        uint64_t start = i << 21;
-        // 0x8f means present + writable + writethrough + cache disable + page size
-        l2[i] = start + 0x8f;
+    // program the PAT and find out what the firmware has put in the MTRRs
+    MemoryType::init();
+    MemoryType::dump(_console);
+
+    /// \bug only the first 512GB of physical memory is mapped
+    static const uint64_t map_limit = uint64_t(512) << 30;
+    mappable.add(0, 1 << 20);
+    if(multiboot->flags & Multiboot::FLAG_MEM_MAP) {
+        // RAM is shrunk to whole pages, as a partial page at either end may
+        // share its page with something that mustn't be cached, but the ACPI
+        // tables are grown to whole pages so that all of them are mapped
+        for(Multiboot::e820_iterator_t zone = multiboot->e820.begin(); zone != multiboot->e820.end(); ++zone)
+            if(zone->type == E820::RAM)
+                mappable.add(
+                    round_up(zone->base, uint64_t(4096)),
+                    min(round_down(zone->base + zone->length, uint64_t(4096)), map_limit)
+                    );
+            else if(zone->type == E820::ACPI || zone->type == E820::NVS)
+                mappable.add(
+                    round_down(zone->base, uint64_t(4096)),
+                    min(round_up(zone->base + zone->length, uint64_t(4096)), map_limit)
+                    );
+    } else {
+        mappable.add(1 << 20, (1 << 20) + round_down(uint64_t(multiboot->mem_upper) << 10U, uint64_t(4096)));
     }
 
     // now we need some level 3 (Page Directory Pointer) tables which map 512GB
     // of RAM in 1GB chunks. We need two of these, one for the identity
     // mappings and the heap (as these can be shared) and one for the kernel.
-    uint64_t *l3heap = new uint64_t[512];
-    // 15 means present + writable + writethrough + cache disable
-    for(int i = 0; i < 512; ++i)
-        l3heap[i] = uint64_t(l2 + i * 512) + 15;
-    uint64_t *l3kernel = new uint64_t[512];
-    for(int i = 0; i < 510; ++i) // FIXME: currently necessary as new doesn't clear memory
-        l3kernel[i] = 0;
-    l3kernel[510] = l3heap[0];
-    l3kernel[511] = l3heap[1];
+    // The lower levels are built on demand by map_range().
+    bool gigabyte_pages = has_gigabyte_pages();
+    uint64_t *l3heap = allocate_table(512);
+    mappable.for_each_free([&](Memblock::Address begin, Memblock::Address end) {
+            map_range(l3heap, begin, end, gigabyte_pages);
+        });
+    uint64_t *l3kernel = allocate_table(512);
+    map_kernel(l3kernel, reinterpret_cast<const KernelHeader *>(__kernel_start));
 
     // Finally, the level 4 (PML4) tables which map the 256TB of memory into 512GB
     // chunks.
-    uint64_t *l4 = new uint64_t[512];
-    for(int i = 0; i < 512; ++i) // FIXME: currently necessary as new doesn't clear memory
-        l4[i] = 0;
-    l4[0] = uint64_t(l3heap) + 15;
-    l4[256] = uint64_t(l3heap) + 15;
-    l4[511] = uint64_t(l3kernel) + 15;
+    uint64_t *l4 = allocate_table(512);
+    l4[0] = uint64_t(l3heap) | PAGE_PRESENT | PAGE_WRITABLE;
+    l4[256] = uint64_t(l3heap) | PAGE_PRESENT | PAGE_WRITABLE;
+    l4[511] = uint64_t(l3kernel) | PAGE_PRESENT | PAGE_WRITABLE;
 
     kprintf(" Set %%cr0 (disable paging)...");
     cr0(1); // desired effect is to clear paging; need to leave protected mode set
@@ -572,7 +653,9 @@ Handover *Handover::__boot_init(const Multiboot *multiboot)
     cr0(0x80000001); // paging + protected mode
     kprintf(" OK\n");
 
-    Heap::dump(_console);
-    return new Handover(*multiboot);
+    Handover *handover = new Handover(*multiboot);
+    handover->boot_init_tsc = init_tsc;
+    memblock.dump(_console);
+    return handover;
 }
 
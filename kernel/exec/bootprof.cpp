@@ -0,0 +1,63 @@
+// -*- mode: c++ -*-
+/**
+   \brief Boot phase profiler (implementation)
+   \file
+*/
+
+#include <stddef.h>
+
+#include "exec/bootprof.hpp"
+#include "exec/format.hpp"
+#include "exec/tsc.hpp"
+
+using namespace exec;
+
+/** \defgroup exec_bootprof BootProfile: where boot time goes
+
+    Each interesting point during boot calls BootProfile::mark() with the
+    name of the phase that starts there, which costs one \c rdtsc and a store.
+    The bootloader can't call it (the marks live in the kernel image), so it
+    reads the time stamp counter itself and passes the readings on in the
+    Handover.
+
+    At the end of initialisation, dump() prints how long each phase took
+    (measured with the TSC), first as a table and then as lines of the form
+
+        bootprof: <phase> <microseconds>
+
+    which are easy to pick out of a serial log and compare between builds.
+
+    @{
+*/
+
+BootProfile::Mark BootProfile::marks[BootProfile::MAX_MARKS];
+size_t BootProfile::count = 0;
+
+/** @} */
+
+
+
+/* ====================================================================== */
+//! prints the time taken by each phase, from its mark to the next mark or now
+void BootProfile::dump(Formatter &formatter)
+{
+    uint64_t now = TSC::now();
+    uint64_t khz = TSC::khz();
+    if(!count || !khz)
+        return;
+
+    EXEC_FORMAT(formatter, "Boot profile (TSC %'llu kHz):\n", khz);
+    EXEC_FORMAT(formatter, "  %-24s %16s %12s\n", "phase", "cycles", "us");
+    for(size_t i = 0; i < count; ++i) {
+        uint64_t cycles = (i + 1 < count ? marks[i + 1].tsc : now) - marks[i].tsc;
+        EXEC_FORMAT(formatter, "  %-24s %'16llu %'12llu\n", marks[i].name, cycles, cycles * 1000 / khz);
+    }
+    EXEC_FORMAT(formatter, "  %-24s %'16llu %'12llu\n", "total", now - marks[0].tsc, (now - marks[0].tsc) * 1000 / khz);
+
+    EXEC_FORMAT(formatter, "bootprof: tsc_khz %llu\n", khz);
+    for(size_t i = 0; i < count; ++i) {
+        uint64_t cycles = (i + 1 < count ? marks[i + 1].tsc : now) - marks[i].tsc;
+        EXEC_FORMAT(formatter, "bootprof: %s %llu\n", marks[i].name, cycles * 1000 / khz);
+    }
+    EXEC_FORMAT(formatter, "bootprof: total %llu\n", (now - marks[0].tsc) * 1000 / khz);
+}
@@ -0,0 +1,50 @@
+// -*- mode: c++ -*-
+/**
+   \brief Boot phase profiler (headers)
+   \file
+*/
+
+#ifndef EXEC_BOOTPROF_HPP
+#define EXEC_BOOTPROF_HPP
+
+/** \addtogroup exec_bootprof
+    @{ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "exec/types.hpp"
+#include "exec/x86.hpp"
+
+/** \brief records the time stamp counter at named points during boot */
+class exec::BootProfile {
+    static const size_t MAX_MARKS = 32; //!< most marks recorded
+
+    //! a named point during boot
+    struct Mark {
+        const char *name;       //!< name of the phase that starts here
+        uint64_t tsc;           //!< time stamp counter at this point
+    };
+
+    static Mark marks[MAX_MARKS]; //!< the marks, in the order they were made
+    static size_t count;        //!< number of entries in #marks
+public:
+    /** \brief records the start of a phase
+        \param name the phase's name, which must be a string literal with no
+        spaces so that the machine-readable output can be parsed
+        \param tsc the time stamp counter at the start of the phase, if it
+        was read elsewhere (for example, by the bootloader) */
+    static void mark(const char *name, uint64_t tsc = rdtsc())
+    {
+        if(count < MAX_MARKS) {
+            marks[count].name = name;
+            marks[count].tsc = tsc;
+            ++count;
+        }
+    }
+    static void dump(Formatter &);
+};
+
+/** @} */
+
+#endif
@@ -0,0 +1,128 @@
+// -*- mode: c++ -*-
+/**
+   \brief Interrupt-driven serial output (implementation)
+   \file
+*/
+
+#include <stddef.h>
+
+#include "exec/apic.hpp"
+#include "exec/bufserial.hpp"
+#include "exec/ioapic.hpp"
+#include "exec/x86.hpp"
+
+using namespace exec;
+
+/** \defgroup exec_bufserial BufferedSerial: interrupt-driven serial output
+
+    Writing to a Serial waits for the UART, which at 115200 baud is most of
+    100us per byte. A BufferedSerial instead copies the bytes into a ring
+    buffer and returns; whenever the transmit FIFO empties, the UART
+    interrupts and the next burst of up to 16 bytes is written from the ring.
+    The first burst is written directly if the transmitter is idle.
+
+    The ring is only touched with interrupts disabled, so the interrupt
+    can't see it half-updated. If it fills up, the writer waits for the UART
+    as Serial does.
+
+    Until enable_interrupt() is called, and whenever interrupts are disabled
+    (in early boot, in interrupt and exception handlers, and when
+    panicking), nothing would drain the ring, so it's flushed and the output
+    is written synchronously instead.
+
+    \bug there is no lock, so only one processor may write at a time.
+
+    @{
+*/
+
+BufferedSerial *BufferedSerial::owner = NULL;
+
+/** @} */
+
+namespace {
+    const uint16_t REG_IER = 1;         //!< interrupt enable
+    const uint16_t REG_IIR = 2;         //!< interrupt identification (read)
+    const uint16_t REG_MCR = 4;         //!< modem control
+
+    const uint8_t IER_THRE = 0x02;      //!< interrupt when the transmitter empties
+    const uint8_t IIR_NONE = 0x01;      //!< no interrupt is pending
+    const uint8_t MCR_DTR_RTS_OUT2 = 0x0b; //!< OUT2 connects the interrupt line on a PC
+}
+
+
+
+/* ====================================================================== */
+/** \brief sets up a serial port, initially written synchronously
+    \param port_ the base I/O port
+    \param baud the bit rate */
+BufferedSerial::BufferedSerial(uint16_t port_, unsigned baud)
+    : Serial(port_, baud), ring(), head(0), tail(0), buffered(false)
+{}
+/** \brief routes the port's interrupt to the processor we're running on,
+    and starts buffering output
+    \param irq the port's ISA interrupt
+    \param vector the vector to use
+    \returns false if the interrupt couldn't be routed */
+bool BufferedSerial::enable_interrupt(unsigned irq, Interrupt::Vector vector)
+{
+    owner = this;
+    Interrupt::set_handler(vector, interrupt);
+    if(!IOAPIC::route_isa(irq, vector, LocalAPIC::id()))
+        return false;
+    outb(uint16_t(port + REG_MCR), MCR_DTR_RTS_OUT2);
+    outb(uint16_t(port + REG_IER), IER_THRE);
+    buffered = true;
+    return true;
+}
+//! adds a byte to the ring, making room synchronously if it's full
+void BufferedSerial::queue(char c)
+{
+    while(head - tail == RING_SIZE) {
+        asm volatile("pause");
+        transmit();
+    }
+    ring[head++ % RING_SIZE] = c;
+}
+//! writes the next burst from the ring, if the transmitter is empty
+void BufferedSerial::transmit(void)
+{
+    if(tail == head || !transmitter_empty())
+        return;
+    for(size_t n = 0; n < fifo_size && tail != head; ++n)
+        outb(port, uint8_t(ring[tail++ % RING_SIZE]));
+    fifo_space = 0;             // so that Serial::put() waits for this burst
+}
+//! writes everything in the ring synchronously
+void BufferedSerial::drain(void)
+{
+    while(tail != head) {
+        asm volatile("pause");
+        transmit();
+    }
+}
+//! handles the port's interrupt
+void BufferedSerial::interrupt(Interrupt::Frame &)
+{
+    BufferedSerial *serial = owner;
+    // reading the IIR acknowledges a transmit interrupt
+    while(!(inb(uint16_t(serial->port + REG_IIR)) & IIR_NONE))
+        serial->transmit();
+}
+//! writes a string, turning newlines into CRLF
+void BufferedSerial::write(const char *start, const char *end)
+{
+    if(!buffered || !Interrupt::enabled()) {
+        drain();
+        Serial::write(start, end);
+        return;
+    }
+    Interrupt::disable();
+    while(start < end) {
+        char c = *start++;
+        if(c == '\n')
+            queue('\r');
+        queue(c);
+    }
+    transmit();
+    Interrupt::enable();
+}
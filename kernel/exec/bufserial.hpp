@@ -0,0 +1,47 @@
+// -*- mode: c++ -*-
+/**
+   \brief Interrupt-driven serial output (headers)
+   \file
+*/
+
+#ifndef EXEC_BUFSERIAL_HPP
+#define EXEC_BUFSERIAL_HPP
+
+/** \addtogroup exec_bufserial
+    @{ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "exec/interrupt.hpp"
+#include "exec/serial.hpp"
+#include "exec/types.hpp"
+
+/** \brief a serial port whose output is queued in a ring buffer and drained
+    by its transmit interrupt */
+class exec::BufferedSerial : public Serial {
+    static const size_t RING_SIZE = 2048; //!< size of #ring, a power of two
+
+    static BufferedSerial *owner; //!< the port whose interrupt is routed
+
+    char ring[RING_SIZE];       //!< bytes waiting to be transmitted
+    size_t head;                //!< count of bytes ever queued
+    size_t tail;                //!< count of bytes ever transmitted
+    bool buffered;              //!< whether the interrupt has been set up
+
+    void queue(char);
+    void transmit(void);
+    void drain(void);
+    static void interrupt(Interrupt::Frame &);
+public:
+    explicit BufferedSerial(uint16_t=COM1, unsigned=MAX_BAUD);
+    BufferedSerial(const BufferedSerial &) = delete;            //!< **deleted**
+    BufferedSerial &operator=(const BufferedSerial &) = delete; //!< **deleted**
+
+    bool enable_interrupt(unsigned, Interrupt::Vector);
+    void write(const char *, const char *);
+};
+
+/** @} */
+
+#endif
@@ -0,0 +1,264 @@
+// -*- mode: c++ -*-
+/**
+   \brief Processors (implementation)
+   \file
+*/
+
+#include <assert.h>
+#include <stddef.h>
+
+#include "exec/acpi.hpp"
+#include "exec/aspace.hpp"
+#include "exec/cpu.hpp"
+#include "exec/format.hpp"
+#include "exec/fpu.hpp"
+#include "exec/interrupt.hpp"
+#include "exec/log.hpp"
+#include "exec/memory.hpp"
+#include "exec/memtype.hpp"
+#include "exec/pagetable.hpp"
+#include "exec/percpu.hpp"
+#include "exec/tsc.hpp"
+#include "exec/x86.hpp"
+
+using namespace exec;
+
+/** \defgroup exec_cpu CPU: processors
+
+    The processors are found by reading the MADT (the ACPI table whose
+    signature is "APIC"), which lists each processor's local APIC. The one
+    we're running on is the bootstrap processor, CPU 0; the others, the
+    application processors (APs), are numbered in the order they're listed.
+
+    Each AP is started in turn by the Intel MultiProcessor Specification
+    sequence: an INIT IPI, 10ms later a start-up IPI (SIPI), and if it hasn't
+    started 200us after that, a second SIPI. The SIPI starts it in real mode
+    at the trampoline (see trampoline.S), which is copied to #TRAMPOLINE in
+    the low memory kept back for it by Handover::__kernel_init2(), and
+    identity-mapped while the APs start so that it can turn on paging. The
+    trampoline's parameter block gives the AP its number and a stack from
+    the Heap, and it ends up in __ap_init(), which finishes setting the
+    processor up (starting with its per-processor variables, see PerCPU)
+    and marks it online.
+
+    An AP that doesn't come online in time is marked failed, and sent an
+    INIT IPI to stop it. It might still have been on its way through the
+    trampoline, so its stack is never freed, and no more APs are started:
+    they would reuse the trampoline's parameter block.
+
+    An online AP waits in idle() for work to be left in its Mailbox by run(),
+    with interrupts enabled so that it can take TLB shootdowns (see
+    AddressSpace::Flush).
+
+    @{
+*/
+
+//! the trampoline's parameter block (see trampoline.S)
+struct exec::CPU::Trampoline {
+    uint32_t cr3;               //!< physical address of the PML4
+    uint32_t cpu;               //!< the processor's number
+    uint64_t stack;             //!< top of the processor's stack
+    uint64_t entry;             //!< where to go in 64 bit mode
+} __attribute__((packed));
+
+CPU::ID CPU::this_cpu EXEC_PERCPU = CPU::BOOT_CPU;
+CPU::ID CPU::cpu_count = 1;
+LocalAPIC::ID CPU::apic_ids[CPU::MAX_CPUS];
+bool CPU::online[CPU::MAX_CPUS] = { true };
+bool CPU::failed[CPU::MAX_CPUS];
+CPU::Mailbox CPU::mailboxes[CPU::MAX_CPUS];
+
+/** @} */
+
+extern "C" char __trampoline_start, __trampoline_end, __trampoline_cr3, __ap_entry;
+
+namespace {
+    const uint64_t TRAMPOLINE = 0x8000; //!< where the trampoline is copied (must match trampoline.S)
+
+    const uint64_t INIT_DELAY_US = 10000;
+    const uint64_t SIPI_DELAY_US = 200;
+    const uint64_t START_TIMEOUT_US = 100000;
+
+    const uint8_t MADT_LOCAL_APIC = 0;
+    const uint8_t MADT_LOCAL_APIC_OVERRIDE = 5;
+
+    //! a processor's local APIC
+    struct MADTLocalAPIC {
+        ACPI::MADTEntry header; //!< type #MADT_LOCAL_APIC
+        uint8_t acpi_id;        //!< the processor's ACPI processor UID
+        uint8_t apic_id;        //!< the processor's local APIC ID
+        uint32_t flags;         //!< MADT_ENABLED, MADT_ONLINE_CAPABLE
+    } __attribute__((packed));
+
+    const uint32_t MADT_ENABLED = 1 << 0;
+
+    //! a 64 bit address for the local APICs, overriding MADT::apic_address
+    struct MADTLocalAPICOverride {
+        ACPI::MADTEntry header; //!< type #MADT_LOCAL_APIC_OVERRIDE
+        uint16_t reserved;      //!< reserved
+        uint64_t apic_address;  //!< physical address of the local APICs
+    } __attribute__((packed));
+}
+
+
+
+/* ====================================================================== */
+/** \brief finds and starts the application processors
+    \returns the number of processors online, including this one */
+CPU::ID CPU::start_aps(void)
+{
+    apic_ids[BOOT_CPU] = 0;
+    uint64_t apic_address = 0;
+    const ACPI::MADT *madt = !ACPI::init() ? NULL : ACPI::for_each_madt_entry([&](const ACPI::MADTEntry &entry) {
+            if(entry.type == MADT_LOCAL_APIC_OVERRIDE)
+                apic_address = reinterpret_cast<const MADTLocalAPICOverride &>(entry).apic_address;
+        });
+    if(!madt)
+        return 1;               // no MADT, so assume there's only us
+    if(!apic_address)
+        apic_address = madt->apic_address;
+    LocalAPIC::init(apic_address);
+    LocalAPIC::enable();
+    LocalAPIC::ID self = LocalAPIC::id();
+    apic_ids[BOOT_CPU] = self;
+
+    ACPI::for_each_madt_entry([&](const ACPI::MADTEntry &entry) {
+            if(entry.type != MADT_LOCAL_APIC)
+                return;
+            const MADTLocalAPIC &local = reinterpret_cast<const MADTLocalAPIC &>(entry);
+            if((local.flags & MADT_ENABLED) && local.apic_id != self && cpu_count < MAX_CPUS)
+                apic_ids[cpu_count++] = local.apic_id;
+        });
+    if(cpu_count == 1)
+        return 1;
+    AddressSpace::init_shootdown();
+
+    // copy the trampoline to low memory, and map it where it will run
+    char *copy = PageTable::virt(TRAMPOLINE);
+    for(const char *from = &__trampoline_start; from < &__trampoline_end; )
+        *copy++ = *from++;
+    AddressSpace &kernel = AddressSpace::kernel();
+    char *identity = reinterpret_cast<char *>(TRAMPOLINE);
+    bool mapped = kernel.map(identity, TRAMPOLINE, Heap::PAGE_SIZE, PageTable::WRITABLE);
+    assert(mapped && "out of memory mapping the trampoline");
+    (void)mapped;
+
+    ID started = 1;
+    for(ID id = 1; id < cpu_count; ++id) {
+        if(start(id))
+            ++started;
+        else if(failed[id])
+            break;              // the trampoline may still be in use
+    }
+
+    kernel.unmap(identity, Heap::PAGE_SIZE);
+    return started;
+}
+/** \brief starts an application processor
+    \param id the processor's number
+    \returns true if it came online */
+bool CPU::start(ID id)
+{
+    char *stack = Heap::allocate_pages(STACK_ORDER);
+    if(!stack)
+        return false;
+    if(!PerCPU::allocate(id)) {
+        Heap::free_pages(stack, STACK_ORDER);
+        return false;
+    }
+
+    Trampoline *trampoline = reinterpret_cast<Trampoline *>(
+        PageTable::virt(TRAMPOLINE + size_t(&__trampoline_cr3 - &__trampoline_start)));
+    trampoline->cr3 = uint32_t(AddressSpace::kernel().root());
+    trampoline->cpu = id;
+    trampoline->stack = reinterpret_cast<uintptr_t>(stack + (Heap::PAGE_SIZE << STACK_ORDER));
+    trampoline->entry = reinterpret_cast<uintptr_t>(&__ap_entry);
+    assert(trampoline->cr3 == AddressSpace::kernel().root() && "PML4 above 4GiB");
+
+    uint8_t vector = uint8_t(TRAMPOLINE >> 12);
+    LocalAPIC::send_init(apic_ids[id]);
+    TSC::delay(INIT_DELAY_US);
+    for(unsigned sipi = 0; sipi < 2 && !__atomic_load_n(&online[id], __ATOMIC_ACQUIRE); ++sipi) {
+        LocalAPIC::send_startup(apic_ids[id], vector);
+        TSC::delay(SIPI_DELAY_US);
+    }
+
+    uint64_t deadline = TSC::now() + TSC::from_us(START_TIMEOUT_US);
+    while(!__atomic_load_n(&online[id], __ATOMIC_ACQUIRE)) {
+        if(TSC::now() > deadline) {
+            // the stack is leaked, as the processor might yet be using it
+            failed[id] = true;
+            LocalAPIC::send_init(apic_ids[id]);
+            return false;
+        }
+        asm volatile("pause");
+    }
+    return true;
+}
+/** \brief finishes setting up an application processor, on its own stack
+    \param id the processor's number */
+void CPU::__ap_init(ID id)
+{
+    PerCPU::init_cpu(id);
+    PerCPU::write(this_cpu, id);
+    Log::init_cpu(id);
+    Cache::init_cpu();
+    MemoryType::init_cpu();
+    AddressSpace::init_cpu();
+    Interrupt::init_cpu(id);
+    FPU::init_cpu();
+    LocalAPIC::enable();
+    __atomic_store_n(&online[id], true, __ATOMIC_RELEASE);
+    idle(id);
+}
+/** \brief waits for work to be left in a processor's Mailbox, and does it
+    \param id the processor's number */
+void CPU::idle(ID id)
+{
+    Mailbox &mailbox = mailboxes[id];
+    Interrupt::enable();
+    for(;;) {
+        Function function = __atomic_load_n(&mailbox.function, __ATOMIC_ACQUIRE);
+        if(!function) {
+            asm volatile("pause");
+            continue;
+        }
+        function(mailbox.argument);
+        __atomic_store_n(&mailbox.function, Function(NULL), __ATOMIC_RELEASE);
+    }
+}
+/** \brief gives an idle application processor some work, waiting for it to
+    finish any it's already been given
+    \param id the processor's number
+    \param function the work to do
+    \param argument the argument to \p function
+    \returns false if the processor isn't online
+
+    \bug only one processor at a time can give work to another.
+*/
+bool CPU::run(ID id, Function function, void *argument)
+{
+    if(id >= cpu_count || id == current() || !__atomic_load_n(&online[id], __ATOMIC_ACQUIRE))
+        return false;
+    Mailbox &mailbox = mailboxes[id];
+    while(__atomic_load_n(&mailbox.function, __ATOMIC_ACQUIRE))
+        asm volatile("pause");
+    mailbox.argument = argument;
+    __atomic_store_n(&mailbox.function, function, __ATOMIC_RELEASE);
+    return true;
+}
+/** \brief sends an interrupt to another processor
+    \param id the processor's number
+    \param vector the vector
+    \returns true if the interrupt was accepted */
+bool CPU::interrupt(ID id, Interrupt::Vector vector)
+{
+    return LocalAPIC::send_interrupt(apic_ids[id], vector);
+}
+void CPU::dump(Formatter &formatter)
+{
+    EXEC_FORMAT(formatter, "CPUs: %u found\n", cpu_count);
+    for(ID id = 0; id < cpu_count; ++id)
+        EXEC_FORMAT(formatter, "  CPU %u: APIC ID %u, %s\n", id, unsigned(apic_ids[id]),
+                  is_online(id) ? "online" : failed[id] ? "failed to start" : "offline");
+}
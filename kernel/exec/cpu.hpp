@@ -0,0 +1,64 @@
+// -*- mode: c++ -*-
+/**
+   \brief Processors (headers)
+   \file
+*/
+
+#ifndef EXEC_CPU_HPP
+#define EXEC_CPU_HPP
+
+/** \addtogroup exec_cpu
+    @{ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "exec/apic.hpp"
+#include "exec/percpu.hpp"
+#include "exec/types.hpp"
+
+/** \brief a processor in the system */
+class exec::CPU {
+public:
+    typedef unsigned ID;
+    static const ID MAX_CPUS = 16; //!< upper bound on processors supported
+    static const ID BOOT_CPU = 0;  //!< the bootstrap processor
+    typedef void (*Function)(void *); //!< work for a processor to do
+private:
+    struct Trampoline;
+
+    static const unsigned STACK_ORDER = 2; //!< log2 of the number of pages in an application processor's stack
+
+    //! where work is left for an idle processor
+    struct Mailbox {
+        Function function;      //!< the work to do, or NULL if there is none
+        void *argument;         //!< the argument to #function
+    } __attribute__((aligned(64)));
+
+    static ID this_cpu;         //!< (per-processor) the processor's number
+    static ID cpu_count;        //!< number of processors found
+    static LocalAPIC::ID apic_ids[MAX_CPUS]; //!< each processor's local APIC ID
+    static bool online[MAX_CPUS]; //!< whether each processor has started
+    static bool failed[MAX_CPUS]; //!< whether each processor timed out starting
+    static Mailbox mailboxes[MAX_CPUS]; //!< each processor's mailbox
+
+    static bool start(ID);
+    static void idle(ID) __attribute__((noreturn));
+    static void __ap_init(ID) asm("__ap_init") __attribute__((noreturn));
+public:
+    /** \brief gets the processor we're executing on
+        \returns the current processor number, in the range [0, MAX_CPUS) */
+    static ID current(void) { return PerCPU::read(this_cpu); }
+    //! \returns the number of processors found
+    static ID count(void) { return cpu_count; }
+    //! \returns whether a processor has started
+    static bool is_online(ID id) { return __atomic_load_n(&online[id], __ATOMIC_ACQUIRE); }
+    static ID start_aps(void);
+    static bool run(ID, Function, void *);
+    static bool interrupt(ID, Interrupt::Vector);
+    static void dump(Formatter &);
+};
+
+/** @} */
+
+#endif
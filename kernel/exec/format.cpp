@@ -7,28 +7,105 @@
 #include <stdarg.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <string.h>
 
 #include "exec/format.hpp"
 #include "exec/util.hpp"
 using namespace exec;
 
-//! \bug move this method, and possibly optimise it
-static inline size_t strnlen(const char *string, size_t maxlen) {
-    size_t length = 0;
-    while(*string++ && length <= maxlen)
-        ++length;
-    return length;
-}
+namespace {
+    //! "00" to "99", so that decimal is converted two digits at a time
+    const char DECIMAL_PAIRS[] =
+        "0001020304050607080910111213141516171819"
+        "2021222324252627282930313233343536373839"
+        "4041424344454647484950515253545556575859"
+        "6061626364656667686970717273747576777879"
+        "8081828384858687888990919293949596979899";
+
+    //! "00" to "ff", so that hexadecimal is converted a byte at a time
+    const char HEX_PAIRS[] =
+        "000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f"
+        "202122232425262728292a2b2c2d2e2f303132333435363738393a3b3c3d3e3f"
+        "404142434445464748494a4b4c4d4e4f505152535455565758595a5b5c5d5e5f"
+        "606162636465666768696a6b6c6d6e6f707172737475767778797a7b7c7d7e7f"
+        "808182838485868788898a8b8c8d8e8f909192939495969798999a9b9c9d9e9f"
+        "a0a1a2a3a4a5a6a7a8a9aaabacadaeafb0b1b2b3b4b5b6b7b8b9babbbcbdbebf"
+        "c0c1c2c3c4c5c6c7c8c9cacbcccdcecfd0d1d2d3d4d5d6d7d8d9dadbdcdddedf"
+        "e0e1e2e3e4e5e6e7e8e9eaebecedeeeff0f1f2f3f4f5f6f7f8f9fafbfcfdfeff";
+
+    /** \brief writes a value's decimal digits right-to-left
+        \param end one-past-end of where to write them
+        \param value the value
+        \returns the start of the digits */
+    char *decimal(char *end, uintmax_t value)
+    {
+        // a 64 bit division by a constant is a multiply and shift on x86_64,
+        // but a call into libgcc in the 32 bit bootloader, so switch to 32
+        // bit arithmetic as soon as the value fits
+        while(value > 0xffffffff) {
+            uintmax_t quotient = value / 100;
+            const char *pair = DECIMAL_PAIRS + 2 * (value - quotient * 100);
+            *--end = pair[1];
+            *--end = pair[0];
+            value = quotient;
+        }
+        uint32_t low = uint32_t(value);
+        while(low >= 100) {
+            uint32_t quotient = low / 100;
+            const char *pair = DECIMAL_PAIRS + 2 * (low - quotient * 100);
+            *--end = pair[1];
+            *--end = pair[0];
+            low = quotient;
+        }
+        if(low >= 10) {
+            *--end = DECIMAL_PAIRS[2 * low + 1];
+            *--end = DECIMAL_PAIRS[2 * low];
+        } else {
+            *--end = char('0' + low);
+        }
+        return end;
+    }
 
-extern "C" void *memset(void *s, int c, size_t n) {
-    char *p = static_cast<char *>(s);
-    while(n--)
-        *p++ = char(c);
-    return s;
-}
+    /** \brief writes a value's hexadecimal digits right-to-left
+        \param end one-past-end of where to write them
+        \param value the value
+        \returns the start of the digits */
+    char *hexadecimal(char *end, uintmax_t value)
+    {
+        do {
+            const char *pair = HEX_PAIRS + 2 * (value & 0xff);
+            *--end = pair[1];
+            *--end = pair[0];
+            value >>= 8;
+        } while(value);
+        // a leading zero nybble; there are always at least two digits
+        if(*end == '0')
+            ++end;
+        return end;
+    }
 
-//! \bug move this method
-#define memset(s, c, n) __builtin_memset(s, c, n)
+    /** \brief inserts a separator between each group of digits, moving them
+        left to make room
+        \param start start of the digits
+        \param end one-past-end of the digits
+        \param size the number of digits in a group
+        \param separator the separator
+        \returns the new start of the digits */
+    char *group(char *start, const char *end, size_t size, char separator)
+    {
+        size_t digits = size_t(end - start), separators = (digits - 1) / size;
+        char *to = start - separators, *result = to;
+        // the leading group is the short one
+        for(size_t n = digits - separators * size; n; --n)
+            *to++ = *start++;
+        while(to < start) {
+            *to++ = separator;
+            for(size_t n = size; n; --n)
+                *to++ = *start++;
+        }
+        return result;
+    }
+}
 
 /** \brief output multiple copies of the same character to the output stream
     \param character the charater to output
@@ -44,7 +121,7 @@ void Formatter::output_repeat(char character, size_t count)
 {
     static const size_t SCRATCH_SIZE = 64;
     char buffer[SCRATCH_SIZE];
-    memset(buffer, SCRATCH_SIZE, character);
+    memset(buffer, character, SCRATCH_SIZE);
     while(count) {
         size_t outputsize = min(count, SCRATCH_SIZE);
         output(buffer, buffer + outputsize);
@@ -74,6 +151,28 @@ void Formatter::operator()(const char *format_, ...)
     vformat(format_, args);
     va_end(args);
 }
+/** \brief format a string with parameters captured earlier (see Log)
+    \param format_ the output format (see vformat())
+    \param values the parameters, converted to integers as print() would
+    (sign-extended if signed, and strings and pointers as their addresses)
+    \param count the number of parameters, which should be the number of
+    fields in the format */
+void Formatter::replay(const char *format_, const uintmax_t *values, size_t count)
+{
+    for(size_t i = 0; i < count; ++i) {
+        format_ = literal(format_);
+        if(!*format_)
+            break;
+        Field field;
+        format_ = parse(format_ + 1, field);
+        if(field.type == 's')
+            emit_string(field, reinterpret_cast<const char *>(values[i]));
+        else
+            emit_integer(field, values[i]);
+    }
+    literal(format_);
+    output_end();
+}
 /** \brief format a string with parameters (va_list form)
 
     \param format_ the output format
@@ -96,8 +195,7 @@ void Formatter::operator()(const char *format_, ...)
     <dl>
 
     <dt>#</dt><dd>Output in an alternative form. This prepends "0x" to
-    hexadecimal numbers. \bug The alternate form does not work properly with
-    zero-padding as the padding appears to the left of the "0x".</dd>
+    hexadecimal numbers (before any zero-padding).</dd>
 
     <dt>0</dt><dd>Zero-pad the output instead of the default of space-padding.
     This forces right-justification.</dd>
@@ -124,7 +222,8 @@ void Formatter::operator()(const char *format_, ...)
 
     <dd>For integral types, this sets the size of the value that will be read
     from the input buffer. The default is int. It is important to set this
-    correctly or the output will become corrupted.</dd>
+    correctly or the output will become corrupted; #EXEC_FORMAT checks it at
+    compile time.</dd>
 
     <dl>
 
@@ -177,239 +276,337 @@ void Formatter::operator()(const char *format_, ...)
 */
 void Formatter::vformat(const char *format_, va_list args)
 {
-    // essentially we're running a few intermingled state machines.
-    while(char next = *format_) {
-        if(next != '%') {
-            // simple case, literal text - just scan for end of string
-            // or % marker, then render as-is.
-            const char *start = format_++;
-            while(*format_ && *format_ != '%')
-                ++format_;
-            output(start, format_);
-        } else {
-            ++format_;   // skip over %
-            // parse format string, then obtain arguments from input_data
-            // array and output result
-            // we now get to parse a %-specifier of the form %[flags][width.limit][length]type
-
-            // (re-)initialise formatting variables
-            bool alternate_form = false; // use "alternate form", e.g. "0x" prefix
-            bool zero_fill = false; // fill with '0' characters (otherwise ' ')
-            bool left_justified = false; // left-justify output (otherwise right-justify)
-            bool grouped = false; // group digits
-            size_t width = 0; // minimum output width (fill to reach this width)
-            size_t limit = ~0U; // truncate at this position
-            // integer size to pull off format list
-            enum IntSize { CHAR, SHORT, INT, LONG, LONGLONG, INTMAX_T, SIZE_T, PTRDIFF_T, POINTER } intsize = INT;
-
-            // the scratch is used for formatting numbers. These are
-            // formatted right-to-left, so we start with p being scratch_end
-            // and working down. Eventually the number is in [p,
-            // scratch_end). The largest value it will format is 2**64 in
-            // decimal, 20 digits, plus one sign digit, plus six commas, or
-            // 27 characters in total. No NUL is required on the end, but
-            // it's rounded up to 32 anyway, to make sure and to ensure nice
-            // alignment.
-
-            const int scratch_size = 32;
-            char scratch[scratch_size]; // scratch for number printing
-            // start and end of output text
-            char *start = scratch + scratch_size;
-            char *end = start;
-
-            // process flag characters
-            while(true) {
-                switch(*format_) {
-                case '#':
-                    alternate_form = true;
-                    break;
-                case '0':
-                    zero_fill = true;
-                    break;
-                case '-':
-                    left_justified = true;
-                    break;
-                case '\'':
-                    grouped = true;
-                    break;
-                default:
-                    goto endflag;
-                }
-                ++format_;
+    while(*(format_ = literal(format_))) {
+        Field field;
+        format_ = parse(format_ + 1, field);
+        switch(field.type) {
+        case 'c': case 'd': case 'u': case 'x': case 'p': {
+            uintmax_t value;
+            if(field.type == 'p') {
+                value = reinterpret_cast<uintptr_t>(va_arg(args, void *));
+                emit_integer(field, value);
+                break;
             }
-        endflag:
-
-            while(*format_ >= '0' && *format_ <= '9')
-                width = width * 10 + *format_++ - '0';
-
-            if(width)
-                zero_fill = false;
-
-            if(*format_ == '.')
-                while(*++format_ >= '0' && *format_ <= '9')
-                    limit = limit * 10 + *format_ - '0';
-
-            switch(*format_++) {
-            case 'h':
-                if(*format_ == 'h') {
-                    ++format_;
-                    intsize = CHAR;
-                } else
-                    intsize = SHORT;
+            switch(field.length) {
+            default:
+                // note, char and short are promoted to int when passed through ...
+                value = va_arg(args, int);
                 break;
             case 'l':
-                if(*format_ == 'l') {
-                    ++format_;
-                    intsize = LONGLONG;
-                } else
-                    intsize = LONG;
+                value = va_arg(args, long);
                 break;
-            case 'q':
-                intsize = LONGLONG;
+            case 'L':
+                value = va_arg(args, long long);
                 break;
             case 'j':
-                intsize = INTMAX_T;
+                value = va_arg(args, intmax_t);
                 break;
             case 'z':
-                intsize = SIZE_T;
+                value = va_arg(args, size_t);
                 break;
             case 't':
-                intsize = PTRDIFF_T;
-                break;
-            default:
-                // we didn't have a word size, so move the pointer back again
-                --format_;
+                value = va_arg(args, ptrdiff_t);
                 break;
             }
+            emit_integer(field, value);
+            break;
+        }
+        case 's':
+            emit_string(field, va_arg(args, const char *));
+            break;
+        case '\0':
+            break;
+        default:
+            // just output the format character
+            emit(field, &field.type, &field.type + 1);
+            break;
+        }
+    }
+    output_end();
+}
+/** \brief parses a %-specifier
+    \param format_ the specifier, after the '%'
+    \param field receives the parsed specifier
+    \returns the rest of the format (which is at the NUL if the specifier
+    was cut short by one) */
+const char *Formatter::parse(const char *format_, Field &field)
+{
+    field.alternate_form = false;
+    field.zero_fill = false;
+    field.left_justified = false;
+    field.grouped = false;
+    field.width = 0;
+    field.limit = ~size_t(0);
+    field.length = 0;
+
+    // process flag characters
+    while(true) {
+        switch(*format_) {
+        case '#':
+            field.alternate_form = true;
+            break;
+        case '0':
+            field.zero_fill = true;
+            break;
+        case '-':
+            field.left_justified = true;
+            break;
+        case '\'':
+            field.grouped = true;
+            break;
+        default:
+            goto endflag;
+        }
+        ++format_;
+    }
+endflag:
+    if(field.left_justified)
+        field.zero_fill = false;
+
+    while(*format_ >= '0' && *format_ <= '9')
+        field.width = field.width * 10 + size_t(*format_++ - '0');
+
+    if(*format_ == '.') {
+        field.limit = 0;
+        while(*++format_ >= '0' && *format_ <= '9')
+            field.limit = field.limit * 10 + size_t(*format_ - '0');
+    }
+
+    switch(*format_++) {
+    case 'h':
+        if(*format_ == 'h') {
+            ++format_;
+            field.length = 'H';
+        } else
+            field.length = 'h';
+        break;
+    case 'l':
+        if(*format_ == 'l') {
+            ++format_;
+            field.length = 'L';
+        } else
+            field.length = 'l';
+        break;
+    case 'q':
+        field.length = 'L';
+        break;
+    case 'j': case 'z': case 't':
+        field.length = format_[-1];
+        break;
+    default:
+        // we didn't have a word size, so move the pointer back again
+        --format_;
+        break;
+    }
+
+    // if a NUL, leave it for the caller to see
+    field.type = *format_;
+    if(field.type)
+        ++format_;
+    return format_;
+}
+/** \brief outputs literal text, with "%%" as "%", up to the next field
+    \param format_ the format
+    \returns the '%' starting the next field, or the end of the format */
+const char *Formatter::literal(const char *format_)
+{
+    for(;;) {
+        const char *start = format_;
+        while(*format_ && *format_ != '%')
+            ++format_;
+        if(format_ != start)
+            output(start, format_);
+        if(*format_ != '%' || format_[1] != '%')
+            return format_;
+        output(format_, format_ + 1);
+        format_ += 2;
+    }
+}
+/** \brief outputs a field's text, padded and truncated as it asks
+    \param field the field
+    \param start start of the text
+    \param end one-past-end of the text */
+void Formatter::emit(const Field &field, const char *start, const char *end)
+{
+    size_t length = size_t(end - start);
+    if(length > field.limit) {
+        // truncate output to limit characters
+        output(start, start + field.limit);
+    } else if(length >= field.width) {
+        // text is at least as long as desired width so output as-is
+        output(start, end);
+    } else if(field.zero_fill) {
+        output_repeat('0', field.width - length);
+        output(start, end);
+    } else if(field.left_justified) {
+        output(start, end);
+        output_repeat(' ', field.width - length);
+    } else {
+        output_repeat(' ', field.width - length);
+        output(start, end);
+    }
+}
+/** \brief outputs an integer field
+    \param field_ the field, whose type is one of c, d, u, x or p
+    \param value the value, sign-extended if it's signed */
+void Formatter::emit_integer(const Field &field_, uintmax_t value)
+{
+    Field field = field_;
+    char type = field.type;
+    if(type == 'p') {
+        //pointer type, hardwire pointer-length hex string, with 0x
+        //prefix and grouping.
+        type = 'x';
+        field.alternate_form = true;
+        field.grouped = true;
+    }
+
+    // the scratch is used for formatting numbers. These are formatted
+    // right-to-left, so we start with p being scratch_end and working down.
+    // Eventually the number is in [p, scratch_end). The largest value it
+    // will format is 2**64 in decimal, 20 digits, plus one sign digit, plus
+    // six commas, or 27 characters in total. No NUL is required on the end,
+    // but it's rounded up to 32 anyway, to make sure and to ensure nice
+    // alignment.
+    const int scratch_size = 32;
+    char scratch[scratch_size]; // scratch for number printing
+    char *end = scratch + scratch_size, *start = end;
+    bool negative = false; // minus sign to be put in output
+
+    switch(type) {
+    case 'c':
+        *--start = static_cast<char>(value);
+        break;
+    case 'd':
+        if(static_cast<intmax_t>(value) < 0) {
+            value = -value;
+            negative = true;
+        }
+        // fall-thru
+    case 'u':
+        start = decimal(end, value);
+        if(field.grouped)
+            start = group(start, end, 3, ',');
+        break;
+    case 'x':
+        start = hexadecimal(end, value);
+        if(field.grouped)
+            start = group(start, end, 8, '\'');
+        break;
+    }
+
+    // a sign or "0x" goes before any zero padding
+    const char *digits = start;
+    if(negative) {
+        *--start = '-';
+    } else if(type == 'x' && field.alternate_form) {
+        *--start = 'x';
+        *--start = '0';
+    }
+    size_t length = size_t(end - start);
+    if(field.zero_fill && digits != start && length < field.width && length <= field.limit) {
+        output(start, digits);
+        output_repeat('0', field.width - length);
+        output(digits, end);
+    } else {
+        emit(field, start, end);
+    }
+}
+/** \brief outputs a string field
+    \param field the field
+    \param string the string, which isn't output if it's NULL */
+void Formatter::emit_string(const Field &field, const char *string)
+{
+    static const char empty[] = "";
+    // don't output the string if a NULL pointer
+    if(!string)
+        string = empty;
+    emit(field, string, string + strnlen(string, field.limit));
+}
+
+
+
+/* ====================================================================== */
+/** \brief constructs a formatter that writes into a buffer
+    \param buffer_ the buffer
+    \param size_ the size of the buffer, including room for the NUL */
+BufferFormatter::BufferFormatter(char *buffer_, size_t size_)
+    : buffer(buffer_), size(size_), total(0)
+{
+    if(size)
+        *buffer = '\0';
+}
+void BufferFormatter::output(const char *start, const char *end)
+{
+    size_t length = size_t(end - start);
+    if(total + 1 < size) {
+        char *to = buffer + total;
+        for(const char *stop = start + min(length, size - 1 - total); start < stop; )
+            *to++ = *start++;
+        *to = '\0';
+    }
+    total += length;
+}
+void BufferFormatter::output_repeat(char character, size_t count)
+{
+    if(total + 1 < size) {
+        size_t fits = min(count, size - 1 - total);
+        memset(buffer + total, character, fits);
+        buffer[total + fits] = '\0';
+    }
+    total += count;
+}
+/** \brief formats into a buffer, like snprintf()
+    \param buffer the buffer
+    \param size the size of the buffer, including room for the NUL
+    \param format_ the output format (see Formatter::vformat())
+    \returns the length the output would have had without truncation */
+size_t BufferFormatter::print(char *buffer, size_t size, const char *format_, ...)
+{
+    BufferFormatter formatter(buffer, size);
+    va_list args;
+    va_start(args, format_);
+    formatter.vformat(format_, args);
+    va_end(args);
+    return formatter.length();
+}
+
 
-            switch(char type = *format_++) {
-            case 'p':
-                //pointer type, hardwire pointer-length hex string, with 0x
-                //prefix and grouping.
-                intsize = POINTER;
-                type = 'x';
-                alternate_form = true;
-                zero_fill = true;
-                grouped = true;
-                // fall-through
-            case 'c': case 'd': case 'u': case 'x': {
-                bool negative = false; // minus sign to be put in output
-                uintmax_t value;
-                switch(intsize) {
-                case CHAR:
-                    value = va_arg(args, int); // note, char is promoted to int when passed through ...
-                    break;
-                case SHORT:
-                    value = va_arg(args, int); // note, short is promoted to int when passed through ...
-                    break;
-                case INT:
-                    value = va_arg(args, int);
-                    break;
-                case LONG:
-                    value = va_arg(args, long);
-                    break;
-                case LONGLONG:
-                    value = va_arg(args, long long);
-                    break;
-                case INTMAX_T:
-                    value = va_arg(args, intmax_t);
-                    break;
-                case SIZE_T:
-                    value = va_arg(args, size_t);
-                    break;
-                case PTRDIFF_T:
-                    value = va_arg(args, ptrdiff_t);
-                    break;
-                case POINTER:
-                    value = reinterpret_cast<uintmax_t>(va_arg(args, void *));
-                    break;
-                }
-                // now re-switch based on the desired output format
-                switch(type) {
-                case 'c':
-                    *--start = static_cast<char>(value);
-                    break;
-                case 'd':
-                    if(static_cast<intmax_t>(value) < 0) {
-                        value = -value;
-                        negative = true;
-                    }
-                    // fall-thru
-                case 'u':
-                    if(value) {
-                        int digit = 0;
-                        while(value) {
-                            *--start = static_cast<char>(value % 10 + '0');
-                            value /= 10;
-                            if(grouped && value && !(++digit%3))
-                                *--start = ',';
-                        }
-                    } else {
-                        *--start = '0';
-                    }
-                    if(negative)
-                        *--start = '-';
-                    break;
-                case 'x':
-                    if(value) {
-                        int digit = 0;
-                        while(value) {
-                            int nybble = value % 16;
-                            nybble = (nybble > 9) ? nybble - 10 + 'a' : nybble + '0';
-                            *--start = static_cast<char>(nybble);
-                            value /= 16;
-                            if(grouped && value && !(++digit%8))
-                                *--start = '\'';
-                        }
-                    } else {
-                        *--start = '0';
-                    }
-                    if(alternate_form) {
-                        *--start = 'x';
-                        *--start = '0';
-                    }
-                    break;
-                } // end inside switch()
-                break;
-            }
-            case 's': {
-                char *string = va_arg(args, char *);
-                // don't output the string if a NULL pointer
-                if(string) {
-                    start = string;
-                    end = string + strnlen(string, limit);
-                }
-                break;
-            }
-            case '\0':
-                // if a NUL, we want to step back so that the main loop gets
-                // to see it.
-                --format_;
-                // fall-thru
-            default:
-                // just output the format charater (e.g. '%' if we were given "%%")
-                start = &type;
-                end = start + 1;
-                break;
-            } // end outside switch()
-            size_t length = end - start;
-            if(length > limit) {
-                // truncate output to limit characters
-                output(start, start + limit);
-            } else if(length >= width) {
-                // text is at least as long as desired width so output as-is
-                output(start, end);
-            } else if(zero_fill) {
-                output_repeat('0', width - length);
-                output(start, end);
-            } else if(left_justified) {
-                output(start, end);
-                output_repeat(' ', width - length);
-            } else {
-                output_repeat(' ', width - length);
-                output(start, end);
-            }
 
+/* ====================================================================== */
+/** \brief adds to the buffer, passing it to sink() whenever it fills
+
+    A string at least as long as the buffer goes straight to sink() once the
+    buffer has been flushed, rather than being copied through it. */
+void BufferedFormatter::output(const char *start, const char *end)
+{
+    size_t length = size_t(end - start);
+    if(used + length > BUFFER_SIZE) {
+        flush();
+        if(length >= BUFFER_SIZE) {
+            sink(start, end);
+            return;
         }
     }
+    for(char *to = buffer + used; start < end; )
+        *to++ = *start++;
+    used += length;
+}
+void BufferedFormatter::output_repeat(char character, size_t count)
+{
+    while(count) {
+        if(used == BUFFER_SIZE)
+            flush();
+        size_t fits = min(count, BUFFER_SIZE - used);
+        memset(buffer + used, character, fits);
+        used += fits;
+        count -= fits;
+    }
+}
+//! passes anything in the buffer to sink()
+void BufferedFormatter::flush(void)
+{
+    if(used)
+        sink(buffer, buffer + used);
+    used = 0;
 }
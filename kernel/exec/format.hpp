@@ -8,11 +8,31 @@
 #define UTIL_FORMAT_HPP
 
 #include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
 #include "exec/types.hpp"
 
 /** \brief sprintf-a-like string formatter
+
+    Formatting is either through format() and vformat(), which parse the
+    format at run time and take the arguments through a va_list, or through
+    print(), which takes them as typed template arguments. The #EXEC_FORMAT
+    macro calls print() after checking at compile time that the format
+    matches the arguments.
  */
 class exec::Formatter {
+public:
+    //! a parsed %-specifier (see vformat())
+    struct Field {
+        bool alternate_form;    //!< use "alternate form", e.g. "0x" prefix
+        bool zero_fill;         //!< fill with '0' characters (otherwise ' ')
+        bool left_justified;    //!< left-justify output (otherwise right-justify)
+        bool grouped;           //!< group digits
+        size_t width;           //!< minimum output width (fill to reach this width)
+        size_t limit;           //!< truncate at this position
+        char length;            //!< the length modifier: 0, 'H' (hh), 'h', 'l', 'L' (ll or q), 'j', 'z' or 't'
+        char type;              //!< the conversion character
+    };
 protected:
     virtual void output_repeat(char, size_t);
     /** \brief output a string to the output stream
@@ -22,13 +42,261 @@ protected:
         Subclasses must implement this method to receive the output stream.
     */
     virtual void output(const char *start, const char *end) = 0;
+    /** \brief called at the end of each vformat(), so that subclasses which
+        hold output back can pass it on */
+    virtual void output_end(void)
+    {}
     /** \brief destructor */
     virtual ~Formatter(void)
     {}
+private:
+    static const char *parse(const char *, Field &);
+    const char *literal(const char *);
+    void emit(const Field &, const char *, const char *);
+    void emit_integer(const Field &, uintmax_t);
+    void emit_string(const Field &, const char *);
+
+    // the typed emitters used by print()
+    void print_arg(const Field &f, char v) { emit_integer(f, uintmax_t(intmax_t(v))); }
+    void print_arg(const Field &f, signed char v) { emit_integer(f, uintmax_t(intmax_t(v))); }
+    void print_arg(const Field &f, short v) { emit_integer(f, uintmax_t(intmax_t(v))); }
+    void print_arg(const Field &f, int v) { emit_integer(f, uintmax_t(intmax_t(v))); }
+    void print_arg(const Field &f, long v) { emit_integer(f, uintmax_t(intmax_t(v))); }
+    void print_arg(const Field &f, long long v) { emit_integer(f, uintmax_t(intmax_t(v))); }
+    void print_arg(const Field &f, bool v) { emit_integer(f, v); }
+    void print_arg(const Field &f, unsigned char v) { emit_integer(f, v); }
+    void print_arg(const Field &f, unsigned short v) { emit_integer(f, v); }
+    void print_arg(const Field &f, unsigned v) { emit_integer(f, v); }
+    void print_arg(const Field &f, unsigned long v) { emit_integer(f, v); }
+    void print_arg(const Field &f, unsigned long long v) { emit_integer(f, v); }
+    void print_arg(const Field &f, const void *v) { emit_integer(f, reinterpret_cast<uintptr_t>(v)); }
+    void print_arg(const Field &f, const char *v)
+    {
+        if(f.type == 's')
+            emit_string(f, v);
+        else
+            emit_integer(f, reinterpret_cast<uintptr_t>(v));
+    }
+
+    //! outputs what's left of the format once the arguments run out
+    void print_fields(const char *format_) { literal(format_); }
+    //! outputs the format up to and including the next field, and recurses
+    template <typename T, typename... Rest> void print_fields(const char *format_, const T &arg, const Rest &... rest)
+    {
+        format_ = literal(format_);
+        if(!*format_)
+            return;
+        Field field;
+        format_ = parse(format_ + 1, field);
+        print_arg(field, arg);
+        print_fields(format_, rest...);
+    }
 public:
     void format(const char *, ...);
     void vformat(const char *, va_list);
     void operator()(const char *, ...);
+    void replay(const char *, const uintmax_t *, size_t);
+    /** \brief format a string with typed parameters
+        \param format_ the output format (see vformat()), which should be
+        checked against the arguments with #EXEC_FORMAT
+        \param args the parameters */
+    template <typename... Args> void print(const char *format_, const Args &... args)
+    {
+        print_fields(format_, args...);
+        output_end();
+    }
+};
+
+/** \brief compile-time checking of formats against their arguments
+
+    Check<Args...>::valid() is a constexpr walk of a format which accepts it
+    if each field's conversion suits the corresponding argument type, and
+    there are exactly as many fields as arguments. An integer conversion
+    needs an integer of the size its length modifier implies (no larger than
+    an int without one, as that's what vformat() would read). \c s needs a
+    string, and \c p any pointer.
+*/
+namespace exec {
+namespace formatcheck {
+    enum Kind { OTHER, INTEGER, STRING, POINTER };
+
+    //! classifies an argument type
+    template <typename T> struct Type {
+        static const Kind kind = OTHER; //!< what sort of argument it is
+        static const size_t size = sizeof(T); //!< its size
+    };
+    //! classifies an integer argument type
+    template <typename T> struct IntegerType {
+        static const Kind kind = INTEGER; //!< what sort of argument it is
+        static const size_t size = sizeof(T); //!< its size
+    };
+    //! classifies a string argument type
+    struct StringType {
+        static const Kind kind = STRING; //!< what sort of argument it is
+        static const size_t size = sizeof(char *); //!< its size
+    };
+    template <> struct Type<bool> : IntegerType<bool> {};
+    template <> struct Type<char> : IntegerType<char> {};
+    template <> struct Type<signed char> : IntegerType<signed char> {};
+    template <> struct Type<unsigned char> : IntegerType<unsigned char> {};
+    template <> struct Type<short> : IntegerType<short> {};
+    template <> struct Type<unsigned short> : IntegerType<unsigned short> {};
+    template <> struct Type<int> : IntegerType<int> {};
+    template <> struct Type<unsigned> : IntegerType<unsigned> {};
+    template <> struct Type<long> : IntegerType<long> {};
+    template <> struct Type<unsigned long> : IntegerType<unsigned long> {};
+    template <> struct Type<long long> : IntegerType<long long> {};
+    template <> struct Type<unsigned long long> : IntegerType<unsigned long long> {};
+    template <typename T> struct Type<T *> {
+        static const Kind kind = POINTER; //!< what sort of argument it is
+        static const size_t size = sizeof(T *); //!< its size
+    };
+    template <> struct Type<char *> : StringType {};
+    template <> struct Type<const char *> : StringType {};
+    template <size_t N> struct Type<char[N]> : StringType {};
+    template <size_t N> struct Type<const char[N]> : StringType {};
+
+    constexpr const char *skip_flags(const char *f)
+    {
+        return *f == '#' || *f == '0' || *f == '-' || *f == '\'' ? skip_flags(f + 1) : f;
+    }
+    constexpr const char *skip_digits(const char *f)
+    {
+        return *f >= '0' && *f <= '9' ? skip_digits(f + 1) : f;
+    }
+    constexpr const char *skip_limit(const char *f)
+    {
+        return *f == '.' ? skip_digits(f + 1) : f;
+    }
+    //! \returns the Field::length code of the length modifier at \p f
+    constexpr char length(const char *f)
+    {
+        return
+            f[0] == 'h' ? (f[1] == 'h' ? 'H' : 'h') :
+            f[0] == 'l' ? (f[1] == 'l' ? 'L' : 'l') :
+            f[0] == 'q' ? 'L' :
+            f[0] == 'j' || f[0] == 'z' || f[0] == 't' ? f[0] : 0;
+    }
+    constexpr const char *skip_length(const char *f)
+    {
+        return
+            (f[0] == 'h' && f[1] == 'h') || (f[0] == 'l' && f[1] == 'l') ? f + 2 :
+            length(f) ? f + 1 : f;
+    }
+    //! \returns the size of integer a length modifier reads
+    constexpr size_t length_size(char l)
+    {
+        return
+            l == 'l' ? sizeof(long) :
+            l == 'L' ? sizeof(long long) :
+            l == 'j' ? sizeof(intmax_t) :
+            l == 'z' ? sizeof(size_t) :
+            l == 't' ? sizeof(ptrdiff_t) : sizeof(int);
+    }
+    //! \returns true if a conversion suits an argument type
+    template <typename T> constexpr bool accepts(char l, char type)
+    {
+        return
+            type == 'c' || type == 'd' || type == 'u' || type == 'x' ?
+                Type<T>::kind == INTEGER &&
+                (l == 0 || l == 'h' || l == 'H' ? Type<T>::size <= sizeof(int) : Type<T>::size == length_size(l)) :
+            type == 's' ? Type<T>::kind == STRING :
+            type == 'p' ? Type<T>::kind == POINTER || Type<T>::kind == STRING :
+            false;
+    }
+
+    template <typename... Args> struct Check;
+    //! checks the rest of a format once the arguments have run out
+    template <> struct Check<> {
+        //! \returns true if there are no more fields
+        static constexpr bool valid(const char *f)
+        {
+            return !*f || (*f == '%' ? f[1] == '%' && valid(f + 2) : valid(f + 1));
+        }
+    };
+    //! checks the rest of a format against the rest of the arguments
+    template <typename T, typename... Rest> struct Check<T, Rest...> {
+        //! \returns true if the next field suits \p T, and the rest are valid
+        static constexpr bool valid(const char *f)
+        {
+            return
+                !*f ? false :
+                *f != '%' ? valid(f + 1) :
+                f[1] == '%' ? valid(f + 2) :
+                field(skip_limit(skip_digits(skip_flags(f + 1))));
+        }
+        //! \returns the result of checking from a field's length modifier
+        static constexpr bool field(const char *f)
+        {
+            return accepts<T>(length(f), *skip_length(f)) && Check<Rest...>::valid(skip_length(f) + 1);
+        }
+    };
+
+    //! \returns (in an unevaluated context) the Check for some arguments
+    template <typename... Args> Check<Args...> check(const Args &...);
+}
+}
+
+/** \brief formats through a Formatter, checking at compile time that the
+    format (which must be a string literal) matches the arguments
+    \param formatter the Formatter
+    \param format_ the output format (see Formatter::vformat())
+    \param ... the parameters */
+#define EXEC_FORMAT(formatter, format_, ...)                            \
+    do {                                                                \
+        static_assert(decltype(::exec::formatcheck::check(__VA_ARGS__))::valid(format_), \
+                      "format doesn't match its arguments: " format_);  \
+        (formatter).print(format_, ##__VA_ARGS__);                      \
+    } while(0)
+
+/** \brief formats into a caller-provided buffer, like snprintf()
+
+    The output is truncated to fit, and the buffer is always NUL-terminated
+    (unless it's empty). length() gives the length the output would have had
+    untruncated.
+*/
+class exec::BufferFormatter : public Formatter {
+    char *buffer;               //!< where to write
+    size_t size;                //!< size of #buffer, including the NUL
+    size_t total;               //!< length of the (untruncated) output
+protected:
+    void output(const char *, const char *);
+    void output_repeat(char, size_t);
+public:
+    BufferFormatter(char *, size_t);
+    BufferFormatter(const BufferFormatter &) = delete;            //!< **deleted**
+    BufferFormatter &operator=(const BufferFormatter &) = delete; //!< **deleted**
+
+    //! \returns the length of the output, before truncation
+    size_t length(void) const { return total; }
+    //! \returns true if the output didn't fit
+    bool truncated(void) const { return size && total >= size; }
+    static size_t print(char *, size_t, const char *, ...);
+};
+
+/** \brief collects output in a cache-line-sized buffer, and passes it to
+    the sink in chunks
+
+    A subclass implements sink() in place of output(). Output is passed on
+    when the buffer fills and at the end of each vformat(), so a line is
+    typically one call to the sink rather than one per field.
+*/
+class exec::BufferedFormatter : public Formatter {
+    static const size_t BUFFER_SIZE = 64; //!< one cache line
+
+    char buffer[BUFFER_SIZE];   //!< output not yet passed to sink()
+    size_t used;                //!< number of bytes in #buffer
+protected:
+    void output(const char *, const char *);
+    void output_repeat(char, size_t);
+    void output_end(void) { flush(); }
+    /** \brief receives the buffered output
+        \param start start of the string to output
+        \param end one-past-end of the string to output */
+    virtual void sink(const char *start, const char *end) = 0;
+public:
+    BufferedFormatter(void) : buffer(), used(0) {}
+    void flush(void);
 };
 
 #endif
@@ -0,0 +1,247 @@
+// -*- mode: c++ -*-
+/**
+   \brief FPU, SSE and AVX state (implementation)
+   \file
+*/
+
+#include <assert.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "exec/fpu.hpp"
+#include "exec/memory.hpp"
+#include "exec/x86.hpp"
+
+using namespace exec;
+
+/** \defgroup exec_fpu FPU: FPU, SSE and AVX state
+
+    The kernel is compiled without the x87, MMX and SSE registers (see the
+    Makefile), so the only things that use them are tasks, and sections of
+    kernel code between begin() and end(), such as vectorised copies and
+    checksums.
+
+    init_cpu() enables SSE (CR4.OSFXSR and OSXMMEXCPT) and, where the
+    processor has XSAVE, CR4.OSXSAVE and as many of the AVX and AVX-512
+    components in XCR0 as it supports. A context's registers are saved in a
+    State, which is an XSAVE area (or an FXSAVE area without XSAVE), sized
+    for the enabled components and allocated from a Cache of its own.
+
+    Switching is lazy: switch_to() only records which State is the running
+    context's, and sets CR0.TS unless its registers are already loaded. The
+    first FPU or SIMD instruction after that raises the device-not-available
+    exception, whose handler saves the registers of the context that owns
+    them and loads the running context's. A context that doesn't use the
+    registers never pays for saving them.
+
+    begin() and end() bracket kernel code that uses the registers. begin()
+    disables interrupts, saves the owner's registers, and clears CR0.TS;
+    end() sets it again, so that the running context's registers are loaded
+    when it next uses them. Sections can't be nested, and must be short.
+
+    There's no scheduler yet, so each processor's own context (the boot
+    code and the idle loop) gets a State in init_cpu(), and is the only
+    context that runs.
+
+    @{
+*/
+
+/** \brief the layout of an XSAVE area, as far as the kernel needs to know
+    it; the area is larger if AVX or AVX-512 is enabled */
+struct exec::FPU::State {
+    uint16_t fcw;               //!< x87 control word
+    uint8_t x87[22];            //!< the rest of the x87 environment
+    uint32_t mxcsr;             //!< SSE control and status
+    uint32_t mxcsr_mask;        //!< which bits of MXCSR are supported
+    uint8_t registers[480];     //!< the x87 and XMM registers, and reserved space
+    uint64_t xstate_bv;         //!< which components are saved (0 means all are in their initial state)
+    uint64_t xcomp_bv;          //!< the compacted format's components (unused)
+    uint64_t reserved[6];       //!< reserved
+} __attribute__((aligned(64)));
+
+Cache *FPU::states = NULL;
+size_t FPU::state_size = 0;
+uint64_t FPU::features = 0;
+FPU::State *FPU::owner EXEC_PERCPU = NULL;
+FPU::State *FPU::current EXEC_PERCPU = NULL;
+bool FPU::in_section EXEC_PERCPU = false;
+bool FPU::interrupts EXEC_PERCPU = false;
+
+/** @} */
+
+namespace {
+    const uintptr_t CR0_MP = 1 << 1;    //!< WAIT honours CR0.TS
+    const uintptr_t CR0_EM = 1 << 2;    //!< no FPU: emulate it
+    const uintptr_t CR0_TS = 1 << 3;    //!< task switched: the next FPU instruction traps
+    const uintptr_t CR0_NE = 1 << 5;    //!< report x87 errors as exceptions
+    const uintptr_t CR4_OSFXSR = 1 << 9;
+    const uintptr_t CR4_OSXMMEXCPT = 1 << 10;
+    const uintptr_t CR4_OSXSAVE = 1 << 18;
+
+    const uint32_t CPUID1_ECX_XSAVE = 1 << 26;
+    const uint32_t XCR0 = 0;
+
+    const uint64_t XSTATE_X87 = 1 << 0;
+    const uint64_t XSTATE_SSE = 1 << 1;
+    const uint64_t XSTATE_AVX = 1 << 2;
+    const uint64_t XSTATE_AVX512 = 7 << 5; //!< opmask, ZMM_Hi256 and Hi16_ZMM, which go together
+
+    const uint16_t FCW_INIT = 0x037f;   //!< all x87 exceptions masked, extended precision
+    const uint32_t MXCSR_INIT = 0x1f80; //!< all SSE exceptions masked
+
+    //! clears CR0.TS, so that FPU instructions don't trap
+    inline void clts(void)
+    {
+        asm volatile("clts" : : : "memory");
+    }
+}
+
+
+
+/* ====================================================================== */
+/** \brief chooses which state components to enable, creates the Cache of
+    State areas, and enables the FPU on the processor we're running on
+
+    The Heap and the IDT must already be set up. */
+void FPU::init(void)
+{
+    uint32_t regs[4];
+    cpuid(1, 0, regs);
+    if(regs[2] & CPUID1_ECX_XSAVE) {
+        cpuid(0xd, 0, regs);
+        uint64_t supported = regs[0] | (uint64_t(regs[3]) << 32);
+        features = supported & (XSTATE_X87 | XSTATE_SSE | XSTATE_AVX);
+        if((supported & XSTATE_AVX512) == XSTATE_AVX512 && (features & XSTATE_AVX))
+            features |= XSTATE_AVX512;
+    }
+    enable();
+
+    state_size = sizeof(State);
+    if(features) {
+        // %ebx is the size needed for the components enabled in XCR0
+        cpuid(0xd, 0, regs);
+        if(regs[1] > state_size)
+            state_size = regs[1];
+    }
+    states = new Cache("exec::FPU::State", Cache::DEFAULT, state_size, alignof(State));
+    Interrupt::set_handler(Interrupt::DEVICE_NOT_AVAILABLE, unavailable);
+    init_cpu();
+}
+//! enables the FPU, SSE and the chosen XSAVE components on the processor we're running on
+void FPU::enable(void)
+{
+    cr0((cr0() & ~CR0_EM) | CR0_MP | CR0_NE);
+    cr4(cr4() | CR4_OSFXSR | CR4_OSXMMEXCPT | (features ? CR4_OSXSAVE : 0));
+    if(features)
+        xcr(XCR0, features);
+}
+/** \brief enables the FPU on the processor we're running on, and gives its
+    own context a State
+
+    init() must already have been called (and calls this for the first
+    processor). */
+void FPU::init_cpu(void)
+{
+    enable();
+    asm volatile("fninit");
+    State *state = allocate();
+    assert(state && "out of memory allocating FPU state");
+    PerCPU::write(owner, static_cast<State *>(NULL));
+    PerCPU::write(current, state);
+    PerCPU::write(in_section, false);
+    cr0(cr0() | CR0_TS);
+}
+/** \brief allocates a State holding the registers' initial values
+    \returns the State, or NULL if there was no memory */
+FPU::State *FPU::allocate(void)
+{
+    State *state = reinterpret_cast<State *>(states->allocate());
+    if(!state)
+        return NULL;
+    memset(state, 0, state_size);
+    state->fcw = FCW_INIT;
+    state->mxcsr = MXCSR_INIT;
+    return state;
+}
+/** \brief frees a State, which must not be the running context's
+    \param state the State */
+void FPU::release(State *state)
+{
+    assert(state != PerCPU::read(current) && "releasing the running context's FPU state");
+    if(PerCPU::read(owner) == state)
+        PerCPU::write(owner, static_cast<State *>(NULL));
+    states->release(reinterpret_cast<char *>(state));
+}
+/** \brief makes a State the running context's, to be loaded when it's next
+    used, on the processor we're running on
+
+    A context's State can only be loaded on one processor at a time, so a
+    context moving to another processor must be switched away from first.
+    \param state the State */
+void FPU::switch_to(State *state)
+{
+    assert(!PerCPU::read(in_section) && "switching contexts in an FPU section");
+    PerCPU::write(current, state);
+    if(PerCPU::read(owner) == state)
+        clts();
+    else
+        cr0(cr0() | CR0_TS);
+}
+//! saves the loaded registers \param state where to save them
+void FPU::save(State *state)
+{
+    if(features)
+        asm volatile("xsave64 (%0)"
+                     : : "r"(state), "a"(uint32_t(features)), "d"(uint32_t(features >> 32)) : "memory");
+    else
+        asm volatile("fxsave64 (%0)" : : "r"(state) : "memory");
+}
+//! loads the registers \param state where to load them from
+void FPU::restore(State *state)
+{
+    if(features)
+        asm volatile("xrstor64 (%0)"
+                     : : "r"(state), "a"(uint32_t(features)), "d"(uint32_t(features >> 32)) : "memory");
+    else
+        asm volatile("fxrstor64 (%0)" : : "r"(state) : "memory");
+}
+//! handles the device-not-available exception, by loading the running context's registers
+void FPU::unavailable(Interrupt::Frame &)
+{
+    clts();
+    State *state = PerCPU::read(current);
+    State *loaded = PerCPU::read(owner);
+    if(loaded == state)
+        return;
+    if(loaded)
+        save(loaded);
+    restore(state);
+    PerCPU::write(owner, state);
+}
+/** \brief starts a section of kernel code which uses the FPU, SSE or AVX
+    registers
+
+    Interrupts are disabled until end(). */
+void FPU::begin(void)
+{
+    bool enabled = Interrupt::enabled();
+    Interrupt::disable();
+    assert(!PerCPU::read(in_section) && "FPU sections can't be nested");
+    PerCPU::write(interrupts, enabled);
+    PerCPU::write(in_section, true);
+    clts();
+    if(State *loaded = PerCPU::read(owner)) {
+        save(loaded);
+        PerCPU::write(owner, static_cast<State *>(NULL));
+    }
+}
+//! ends a section started by begin()
+void FPU::end(void)
+{
+    // the registers now hold the section's values, so the running context's
+    // are loaded when it next uses them
+    cr0(cr0() | CR0_TS);
+    PerCPU::write(in_section, false);
+    if(PerCPU::read(interrupts))
+        Interrupt::enable();
+}
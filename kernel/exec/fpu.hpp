@@ -0,0 +1,51 @@
+// -*- mode: c++ -*-
+/**
+   \brief FPU, SSE and AVX state (headers)
+   \file
+*/
+
+#ifndef EXEC_FPU_HPP
+#define EXEC_FPU_HPP
+
+/** \addtogroup exec_fpu
+    @{ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "exec/interrupt.hpp"
+#include "exec/percpu.hpp"
+#include "exec/types.hpp"
+
+/** \brief the FPU, SSE and AVX registers, which are switched between
+    contexts lazily */
+class exec::FPU {
+public:
+    struct State;               //!< a context's saved registers (an XSAVE area)
+private:
+    static Cache *states;       //!< where State areas are allocated from
+    static size_t state_size;   //!< size of a State area
+    static uint64_t features;   //!< the state components in XCR0, or 0 without XSAVE
+
+    static State *owner;        //!< (per-processor) the context whose registers are loaded, or NULL
+    static State *current;      //!< (per-processor) the running context's State
+    static bool in_section;     //!< (per-processor) whether we're between begin() and end()
+    static bool interrupts;     //!< (per-processor) whether begin() disabled interrupts
+
+    static void enable(void);
+    static void save(State *);
+    static void restore(State *);
+    static void unavailable(Interrupt::Frame &);
+public:
+    static void init(void);
+    static void init_cpu(void);
+    static State *allocate(void);
+    static void release(State *);
+    static void switch_to(State *);
+    static void begin(void);
+    static void end(void);
+};
+
+/** @} */
+
+#endif
@@ -18,6 +18,7 @@
 
  */
 class exec::Handover {
+    friend class Memblock;
     class E820;
     class Multiboot;
 
@@ -35,10 +36,12 @@ class exec::Handover {
 
     ptr32<E820> e820_zones;
     uint32_t e820_zone_count;
+    uint64_t boot_start_tsc;    //!< time stamp counter at __boot_start
+    uint64_t boot_init_tsc;     //!< time stamp counter on entry to __boot_init()
 
     char *__kernel_init(void) asm("__kernel_init");
     void __kernel_init2(void) asm("__kernel_init2");
-    static void __kernel_run(void) asm("__kernel_run");
+    static void __kernel_run(void) asm("__kernel_run") __attribute__((noreturn));
 
     Handover(void) = delete;
     Handover(const Handover &) = delete;
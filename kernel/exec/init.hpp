@@ -0,0 +1,19 @@
+// -*- mode: c++ -*-
+/**
+   \brief Initialisation-only code (headers)
+   \file
+*/
+
+#ifndef EXEC_INIT_HPP
+#define EXEC_INIT_HPP
+
+/** \brief places a function in the kernel's .text.init section
+
+    The section is unmapped and its memory given to the Heap once the kernel
+    has finished initialising (see Handover::__kernel_init2()), so functions
+    marked with this must not be called after that. In the bootloader, the
+    section is just part of .text.
+*/
+#define EXEC_INIT __attribute__((section(".text.init")))
+
+#endif
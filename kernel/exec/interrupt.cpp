@@ -0,0 +1,233 @@
+// -*- mode: c++ -*-
+/**
+   \brief Interrupts and exceptions (implementation)
+   \file
+*/
+
+#include <assert.h>
+#include <stddef.h>
+
+#include "exec/apic.hpp"
+#include "exec/cpu.hpp"
+#include "exec/format.hpp"
+#include "exec/interrupt.hpp"
+#include "exec/log.hpp"
+#include "exec/memory.hpp"
+#include "exec/percpu.hpp"
+#include "exec/x86.hpp"
+
+using namespace exec;
+
+/** \defgroup exec_interrupt Interrupt: interrupts and exceptions
+
+    Every vector in the IDT points at a stub in interrupt_entry.S, which
+    saves the caller-saved registers and calls __interrupt() with the
+    resulting Frame. That calls the handler given to set_handler(), if any.
+    Interrupts from the APICs (vectors #FIRST_IRQ and up, apart from
+    #SPURIOUS) are acknowledged once their handler has returned. An exception
+    without a handler is reported to the console and halts the processor; an
+    interrupt without one is ignored.
+
+    The vectors are laid out as follows:
+
+    | Vectors          | Use                                             |
+    |------------------|-------------------------------------------------|
+    | 0x00 to 0x1f     | exceptions                                      |
+    | 0x20 to 0x2f     | the 8259 PICs, which are masked                 |
+    | 0x30 to 0xee     | device interrupts, through the I/O APIC         |
+    | 0xef             | the local APIC timer (see LocalAPIC)            |
+    | 0xff             | the local APIC's spurious interrupt             |
+
+    The PICs are remapped away from the exceptions before they are masked,
+    so that a spurious interrupt from them can't be mistaken for one.
+
+    All gates are interrupt gates, so interrupts are disabled in handlers.
+    The double fault, NMI and machine check exceptions can arrive when the
+    stack can't be trusted, so they switch to stacks of their own through the
+    Interrupt Stack Table in each processor's TSS. The TSS descriptors follow
+    the code and data descriptors in the kernel's GDT (see kernel_entry.S),
+    one per processor.
+
+    The kernel is compiled without the FPU and SSE registers, so handlers
+    leave the interrupted code's alone unless they use FPU::begin().
+
+    \bug there is no user mode yet, so the entry stubs don't \c swapgs.
+
+    @{
+*/
+
+//! an interrupt gate in the IDT
+struct exec::Interrupt::Gate {
+    uint16_t offset_low;        //!< bits 0 to 15 of the handler's address
+    uint16_t selector;          //!< the handler's code segment
+    uint8_t ist;                //!< the IST stack to switch to, or 0
+    uint8_t type;               //!< present, DPL and gate type
+    uint16_t offset_middle;     //!< bits 16 to 31 of the handler's address
+    uint32_t offset_high;       //!< bits 32 to 63 of the handler's address
+    uint32_t reserved;          //!< reserved
+} __attribute__((packed));
+
+//! the 64 bit task state segment, which holds the stacks to switch to
+struct exec::Interrupt::TSS {
+    uint32_t reserved0;         //!< reserved
+    uint64_t rsp[3];            //!< stacks for entry to each privilege level
+    uint64_t reserved1;         //!< reserved
+    uint64_t ist[7];            //!< the Interrupt Stack Table
+    uint64_t reserved2;         //!< reserved
+    uint16_t reserved3;         //!< reserved
+    uint16_t iomap_base;        //!< offset of the I/O permission bitmap
+} __attribute__((packed));
+
+Interrupt::Gate Interrupt::idt[Interrupt::VECTORS];
+Interrupt::Handler Interrupt::handlers[Interrupt::VECTORS];
+Interrupt::TSS Interrupt::tss EXEC_PERCPU;
+Formatter *Interrupt::console = NULL;
+
+/** @} */
+
+extern "C" const uint64_t __interrupt_stubs[];
+extern "C" uint64_t __kernel_gdt[];
+
+namespace {
+    const uint16_t KERNEL_CODE = 0x08;
+    const uint16_t FIRST_TSS = 0x18;    //!< the selector of CPU 0's TSS
+
+    const uint8_t GATE_INTERRUPT = 0x8e; //!< present, DPL 0, 64 bit interrupt gate
+    const uint64_t DESCRIPTOR_TSS = uint64_t(0x89) << 40; //!< present, DPL 0, available 64 bit TSS
+
+    const uint8_t IST_DOUBLE_FAULT = 1;
+    const uint8_t IST_NMI = 2;
+    const uint8_t IST_MACHINE_CHECK = 3;
+    const size_t IST_STACKS = 3;
+
+    const uint16_t PIC1_COMMAND = 0x20;
+    const uint16_t PIC1_DATA = 0x21;
+    const uint16_t PIC2_COMMAND = 0xa0;
+    const uint16_t PIC2_DATA = 0xa1;
+
+    const char *const EXCEPTION_NAMES[] = {
+        "divide error", "debug", "NMI", "breakpoint",
+        "overflow", "bound range exceeded", "invalid opcode", "device not available",
+        "double fault", "coprocessor segment overrun", "invalid TSS", "segment not present",
+        "stack fault", "general protection", "page fault", "reserved",
+        "x87 floating point", "alignment check", "machine check", "SIMD floating point",
+        "virtualisation", "control protection",
+    };
+
+    //! the operand of \c lidt
+    struct IDTPointer {
+        uint16_t limit;         //!< size of the IDT, less one
+        uint64_t base;          //!< address of the IDT
+    } __attribute__((packed));
+
+    //! remaps the 8259 PICs to Interrupt::PIC_BASE, and masks all their interrupts
+    void mask_pic(void)
+    {
+        outb(PIC1_COMMAND, 0x11);       // ICW1: initialise, expect ICW4
+        outb(PIC2_COMMAND, 0x11);
+        outb(PIC1_DATA, Interrupt::PIC_BASE);     // ICW2: vector base
+        outb(PIC2_DATA, Interrupt::PIC_BASE + 8);
+        outb(PIC1_DATA, 4);             // ICW3: slave on IRQ2
+        outb(PIC2_DATA, 2);
+        outb(PIC1_DATA, 1);             // ICW4: 8086 mode
+        outb(PIC2_DATA, 1);
+        outb(PIC1_DATA, 0xff);
+        outb(PIC2_DATA, 0xff);
+    }
+}
+
+
+
+/* ====================================================================== */
+/** \brief builds the IDT and masks the 8259 PICs
+    \param console_ where to report unhandled exceptions */
+void Interrupt::init(Formatter &console_)
+{
+    console = &console_;
+    for(size_t vector = 0; vector < VECTORS; ++vector) {
+        uint64_t stub = __interrupt_stubs[vector];
+        Gate &gate = idt[vector];
+        gate.offset_low = uint16_t(stub);
+        gate.selector = KERNEL_CODE;
+        gate.ist = 0;
+        gate.type = GATE_INTERRUPT;
+        gate.offset_middle = uint16_t(stub >> 16);
+        gate.offset_high = uint32_t(stub >> 32);
+        gate.reserved = 0;
+    }
+    idt[2].ist = IST_NMI;
+    idt[8].ist = IST_DOUBLE_FAULT;
+    idt[18].ist = IST_MACHINE_CHECK;
+    mask_pic();
+}
+/** \brief loads the IDT, and a TSS with the IST stacks, on the processor
+    we're running on
+
+    Its per-processor variables must already be set up (see PerCPU).
+    \param cpu the processor we're running on */
+void Interrupt::init_cpu(unsigned cpu)
+{
+    TSS *t = PerCPU::pointer(tss);
+    for(size_t i = 0; i < IST_STACKS; ++i) {
+        char *stack = Heap::allocate_pages(IST_ORDER);
+        assert(stack && "out of memory allocating an IST stack");
+        t->ist[i] = reinterpret_cast<uintptr_t>(stack + (Heap::PAGE_SIZE << IST_ORDER));
+    }
+    t->iomap_base = sizeof(TSS); // no I/O permission bitmap
+
+    uint64_t base = reinterpret_cast<uintptr_t>(t), limit = sizeof(TSS) - 1;
+    uint16_t selector = uint16_t(FIRST_TSS + cpu * 16);
+    uint64_t *descriptor = &__kernel_gdt[selector / 8];
+    descriptor[0] =
+        (limit & 0xffff) | ((base & 0xffffff) << 16) | DESCRIPTOR_TSS |
+        ((limit & 0xf0000) << 32) | ((base & 0xff000000) << 32);
+    descriptor[1] = base >> 32;
+    asm volatile("ltr %0" : : "r"(selector));
+
+    IDTPointer pointer = { uint16_t(sizeof(idt) - 1), reinterpret_cast<uintptr_t>(idt) };
+    asm volatile("lidt %0" : : "m"(pointer));
+}
+/** \brief sets the handler for a vector
+    \param vector the vector
+    \param handler the handler, or NULL for the default */
+void Interrupt::set_handler(Vector vector, Handler handler)
+{
+    __atomic_store_n(&handlers[vector], handler, __ATOMIC_RELEASE);
+}
+//! reports an exception nothing handles, and halts
+void Interrupt::unhandled(Frame &frame)
+{
+    if(console) {
+        const size_t names = sizeof(EXCEPTION_NAMES) / sizeof(EXCEPTION_NAMES[0]);
+        Formatter &f = *console;
+        Log::flush(f);
+        EXEC_FORMAT(f, "\nCPU %u: %s exception (vector %llu, error %#llx)\n",
+          CPU::current(), frame.vector < names ? EXCEPTION_NAMES[frame.vector] : "unknown",
+          frame.vector, frame.error);
+        EXEC_FORMAT(f, "  rip %#018llx  cs %#llx  rflags %#llx  rsp %#018llx  ss %#llx\n",
+          frame.rip, frame.cs, frame.rflags, frame.rsp, frame.ss);
+        EXEC_FORMAT(f, "  rax %#018llx  rcx %#018llx  rdx %#018llx\n", frame.rax, frame.rcx, frame.rdx);
+        EXEC_FORMAT(f, "  rsi %#018llx  rdi %#018llx  r8  %#018llx\n", frame.rsi, frame.rdi, frame.r8);
+        EXEC_FORMAT(f, "  r9  %#018llx  r10 %#018llx  r11 %#018llx\n", frame.r9, frame.r10, frame.r11);
+        if(frame.vector == PAGE_FAULT) {
+            uintptr_t address;
+            asm volatile("mov %%cr2, %0" : "=r"(address));
+            EXEC_FORMAT(f, "  cr2 %#018llx\n", uint64_t(address));
+        }
+    }
+    for(;;)
+        asm volatile("cli; hlt");
+}
+/** \brief dispatches an interrupt or exception to its handler (called from
+    interrupt_entry.S)
+    \param frame the interrupted state */
+void Interrupt::__interrupt(Frame *frame)
+{
+    Vector vector = Vector(frame->vector);
+    if(Handler handler = __atomic_load_n(&handlers[vector], __ATOMIC_ACQUIRE))
+        handler(*frame);
+    else if(vector < PIC_BASE)
+        unhandled(*frame);
+    if(vector >= FIRST_IRQ && vector != SPURIOUS)
+        LocalAPIC::eoi();
+}
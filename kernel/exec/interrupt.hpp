@@ -0,0 +1,77 @@
+// -*- mode: c++ -*-
+/**
+   \brief Interrupts and exceptions (headers)
+   \file
+*/
+
+#ifndef EXEC_INTERRUPT_HPP
+#define EXEC_INTERRUPT_HPP
+
+/** \addtogroup exec_interrupt
+    @{ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "exec/types.hpp"
+
+/** \brief the interrupt descriptor table, and the dispatch of interrupts and
+    exceptions to their handlers */
+class exec::Interrupt {
+public:
+    typedef uint8_t Vector;     //!< an interrupt vector
+
+    static const Vector DEVICE_NOT_AVAILABLE = 7; //!< the device-not-available (#NM) exception
+    static const Vector PAGE_FAULT = 14;    //!< the page fault exception
+    static const Vector PIC_BASE = 0x20;    //!< where the (masked) 8259 PICs are remapped to
+    static const Vector FIRST_IRQ = 0x30;   //!< the first vector for interrupts from the APICs
+    static const Vector TLB_SHOOTDOWN = 0xee; //!< an IPI asking for TLB invalidations (see AddressSpace::Flush)
+    static const Vector TIMER = 0xef;       //!< the local APIC timer
+    static const Vector SPURIOUS = 0xff;    //!< the local APIC's spurious interrupt
+
+    /** \brief the state of the interrupted code, as saved on the stack by the
+        processor and interrupt_entry.S
+
+        Only the registers a function may clobber are saved, so changes to
+        the others by a handler are not seen by the interrupted code. */
+    struct Frame {
+        uint64_t r11, r10, r9, r8, rdi, rsi, rdx, rcx, rax; //!< the caller-saved registers
+        uint64_t vector;        //!< the vector number
+        uint64_t error;         //!< the error code, or 0 if there isn't one
+        uint64_t rip, cs, rflags, rsp, ss; //!< saved by the processor
+    };
+    typedef void (*Handler)(Frame &); //!< an interrupt or exception handler
+private:
+    struct Gate;
+    struct TSS;
+
+    static const size_t VECTORS = 256;
+    static const unsigned IST_ORDER = 1; //!< log2 of the number of pages in an IST stack
+
+    static Gate idt[VECTORS];   //!< the interrupt descriptor table
+    static Handler handlers[VECTORS]; //!< each vector's handler, or NULL
+    static TSS tss;             //!< (per-processor) the task state segment
+    static Formatter *console;  //!< where unhandled exceptions are reported
+
+    static void unhandled(Frame &) __attribute__((noreturn));
+    static void __interrupt(Frame *) asm("__interrupt");
+public:
+    static void init(Formatter &);
+    static void init_cpu(unsigned);
+    static void set_handler(Vector, Handler);
+    //! allows interrupts on the processor we're running on
+    static void enable(void) { asm volatile("sti" : : : "memory"); }
+    //! stops interrupts on the processor we're running on
+    static void disable(void) { asm volatile("cli" : : : "memory"); }
+    //! \returns whether interrupts are allowed on the processor we're running on
+    static bool enabled(void)
+    {
+        uint64_t flags;
+        asm volatile("pushf; pop %0" : "=r"(flags));
+        return flags & (1 << 9);
+    }
+};
+
+/** @} */
+
+#endif
@@ -0,0 +1,157 @@
+// -*- mode: c++ -*-
+/**
+   \brief I/O APIC (implementation)
+   \file
+*/
+
+#include <assert.h>
+#include <stddef.h>
+
+#include "exec/acpi.hpp"
+#include "exec/aspace.hpp"
+#include "exec/ioapic.hpp"
+#include "exec/memory.hpp"
+#include "exec/pagetable.hpp"
+
+using namespace exec;
+
+/** \defgroup exec_ioapic IOAPIC: device interrupt routing
+
+    Each I/O APIC handles a range of global system interrupts (GSIs), and has
+    a redirection table entry for each, giving the vector, destination
+    processor, polarity and trigger mode. Its registers are reached
+    indirectly: the index is written to IOREGSEL, and the register is then
+    read or written through IOWIN.
+
+    The I/O APICs are listed in the MADT. The legacy ISA interrupts are
+    connected to the GSIs with the same numbers, active high and edge
+    triggered, unless the MADT has an interrupt source override saying
+    otherwise.
+
+    Every entry is masked by init(), and only the interrupts routed by
+    route_isa() are unmasked.
+
+    @{
+*/
+
+IOAPIC::Controller IOAPIC::controllers[IOAPIC::MAX_IOAPICS];
+size_t IOAPIC::controller_count = 0;
+IOAPIC::ISAOverride IOAPIC::isa[IOAPIC::ISA_IRQS];
+
+/** @} */
+
+namespace {
+    const uint8_t MADT_IOAPIC = 1;
+    const uint8_t MADT_SOURCE_OVERRIDE = 2;
+
+    //! an I/O APIC
+    struct MADTIOAPIC {
+        ACPI::MADTEntry header; //!< type #MADT_IOAPIC
+        uint8_t id;             //!< the I/O APIC's ID
+        uint8_t reserved;       //!< reserved
+        uint32_t address;       //!< physical address of its registers
+        uint32_t gsi_base;      //!< the first global system interrupt it handles
+    } __attribute__((packed));
+
+    //! an ISA interrupt that isn't identity-mapped to a GSI
+    struct MADTSourceOverride {
+        ACPI::MADTEntry header; //!< type #MADT_SOURCE_OVERRIDE
+        uint8_t bus;            //!< 0 (ISA)
+        uint8_t source;         //!< the ISA interrupt
+        uint32_t gsi;           //!< the global system interrupt it's connected to
+        uint16_t flags;         //!< MPS INTI flags
+    } __attribute__((packed));
+
+    const uint16_t INTI_POLARITY = 3;       //!< mask
+    const uint16_t INTI_ACTIVE_LOW = 3;
+    const uint16_t INTI_TRIGGER = 3 << 2;   //!< mask
+    const uint16_t INTI_LEVEL = 3 << 2;
+
+    const uint32_t REG_VERSION = 0x01;
+    const uint32_t REG_REDIRECTION = 0x10; //!< two registers per entry
+
+    const uint32_t REDIRECT_ACTIVE_LOW = 1 << 13;
+    const uint32_t REDIRECT_LEVEL = 1 << 15;
+    const uint32_t REDIRECT_MASKED = 1 << 16;
+}
+
+
+
+/* ====================================================================== */
+//! reads an I/O APIC register
+uint32_t IOAPIC::read(const Controller &controller, uint32_t reg)
+{
+    controller.registers[0] = reg;
+    return controller.registers[4];
+}
+//! writes an I/O APIC register
+void IOAPIC::write(const Controller &controller, uint32_t reg, uint32_t value)
+{
+    controller.registers[0] = reg;
+    controller.registers[4] = value;
+}
+//! \returns the I/O APIC handling a GSI, or NULL if there isn't one
+IOAPIC::Controller *IOAPIC::find(GSI gsi)
+{
+    for(size_t i = 0; i < controller_count; ++i)
+        if(gsi >= controllers[i].base && gsi < controllers[i].base + controllers[i].count)
+            return &controllers[i];
+    return NULL;
+}
+/** \brief finds the I/O APICs and ISA interrupt overrides in the MADT, and
+    masks every interrupt
+    \returns false if there are no I/O APICs */
+bool IOAPIC::init(void)
+{
+    for(unsigned irq = 0; irq < ISA_IRQS; ++irq) {
+        isa[irq].gsi = irq;
+        isa[irq].flags = 0;
+    }
+    ACPI::for_each_madt_entry([&](const ACPI::MADTEntry &entry) {
+            if(entry.type == MADT_IOAPIC && controller_count < MAX_IOAPICS) {
+                const MADTIOAPIC &ioapic = reinterpret_cast<const MADTIOAPIC &>(entry);
+                uint64_t page = ioapic.address & ~uint64_t(Heap::PAGE_SIZE - 1);
+                bool ok = AddressSpace::kernel().map(
+                    PageTable::virt(page), page, Heap::PAGE_SIZE, PageTable::WRITABLE, MemoryType::UC);
+                assert(ok && "out of memory mapping an I/O APIC");
+                (void)ok;
+                Controller &controller = controllers[controller_count++];
+                controller.registers = reinterpret_cast<volatile uint32_t *>(PageTable::virt(ioapic.address));
+                controller.base = ioapic.gsi_base;
+                controller.count = ((read(controller, REG_VERSION) >> 16) & 0xff) + 1;
+            } else if(entry.type == MADT_SOURCE_OVERRIDE) {
+                const MADTSourceOverride &override = reinterpret_cast<const MADTSourceOverride &>(entry);
+                if(override.bus == 0 && override.source < ISA_IRQS) {
+                    isa[override.source].gsi = override.gsi;
+                    isa[override.source].flags = override.flags;
+                }
+            }
+        });
+
+    for(size_t i = 0; i < controller_count; ++i)
+        for(unsigned pin = 0; pin < controllers[i].count; ++pin)
+            write(controllers[i], REG_REDIRECTION + 2 * pin, REDIRECT_MASKED);
+    return controller_count;
+}
+/** \brief routes an ISA interrupt to a processor, and unmasks it
+    \param irq the ISA interrupt
+    \param vector the vector to deliver it on
+    \param destination the APIC ID of the processor to deliver it to
+    \returns false if no I/O APIC handles the interrupt */
+bool IOAPIC::route_isa(unsigned irq, Interrupt::Vector vector, LocalAPIC::ID destination)
+{
+    assert(irq < ISA_IRQS && "not an ISA interrupt");
+    const ISAOverride &source = isa[irq];
+    Controller *controller = find(source.gsi);
+    if(!controller)
+        return false;
+    uint32_t low = vector;     // fixed delivery, physical destination
+    if((source.flags & INTI_POLARITY) == INTI_ACTIVE_LOW)
+        low |= REDIRECT_ACTIVE_LOW;
+    if((source.flags & INTI_TRIGGER) == INTI_LEVEL)
+        low |= REDIRECT_LEVEL;
+    uint32_t reg = REG_REDIRECTION + 2 * (source.gsi - controller->base);
+    write(*controller, reg + 1, uint32_t(destination) << 24);
+    write(*controller, reg, low);
+    return true;
+}
@@ -0,0 +1,54 @@
+// -*- mode: c++ -*-
+/**
+   \brief I/O APIC (headers)
+   \file
+*/
+
+#ifndef EXEC_IOAPIC_HPP
+#define EXEC_IOAPIC_HPP
+
+/** \addtogroup exec_ioapic
+    @{ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "exec/apic.hpp"
+#include "exec/interrupt.hpp"
+#include "exec/types.hpp"
+
+/** \brief the I/O APICs, which route device interrupts to the local APICs */
+class exec::IOAPIC {
+public:
+    typedef uint32_t GSI;       //!< a global system interrupt number
+    static const unsigned ISA_IRQS = 16; //!< number of legacy ISA interrupts
+private:
+    static const size_t MAX_IOAPICS = 4; //!< upper bound on I/O APICs supported
+
+    //! an I/O APIC
+    struct Controller {
+        volatile uint32_t *registers; //!< IOREGSEL, with IOWIN at index 4
+        GSI base;               //!< the first global system interrupt it handles
+        unsigned count;         //!< the number of interrupts it handles
+    };
+    //! where an ISA interrupt is connected
+    struct ISAOverride {
+        GSI gsi;                //!< the global system interrupt
+        uint16_t flags;         //!< MPS INTI polarity and trigger mode flags
+    };
+
+    static Controller controllers[MAX_IOAPICS]; //!< the I/O APICs found
+    static size_t controller_count; //!< number of entries in #controllers
+    static ISAOverride isa[ISA_IRQS]; //!< each ISA interrupt's connection
+
+    static uint32_t read(const Controller &, uint32_t);
+    static void write(const Controller &, uint32_t, uint32_t);
+    static Controller *find(GSI);
+public:
+    static bool init(void);
+    static bool route_isa(unsigned, Interrupt::Vector, LocalAPIC::ID);
+};
+
+/** @} */
+
+#endif
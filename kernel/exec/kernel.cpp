@@ -2,132 +2,111 @@
 #include <assert.h>
 #include <new>
 
+#include "exec/apic.hpp"
+#include "exec/aspace.hpp"
+#include "exec/bootprof.hpp"
+#include "exec/bufserial.hpp"
+#include "exec/cpu.hpp"
 #include "exec/format.hpp"
+#include "exec/fpu.hpp"
 #include "exec/handover.hpp"
+#include "exec/init.hpp"
+#include "exec/interrupt.hpp"
+#include "exec/ioapic.hpp"
+#include "exec/log.hpp"
+#include "exec/memblock.hpp"
 #include "exec/memory.hpp"
 #include "exec/memory_priv.hpp"
+#include "exec/memtype.hpp"
+#include "exec/pagetable.hpp"
+#include "exec/percpu.hpp"
+#include "exec/string.hpp"
+#include "exec/tsc.hpp"
 #include "exec/util.hpp"
+#include "exec/x86.hpp"
 using namespace exec;
 
-inline void outb(uint16_t p, uint8_t a)
-{
-    asm volatile("outb %0, %w1" : : "a"(a), "Nd"(p));
-}
-inline uint8_t inb(uint16_t p) 
-{
-    uint8_t a;
-    asm volatile("inb %w1, %0" : "=a"(a) : "Nd"(p));
-    return a;
-}
-inline void outw(uint16_t p, uint16_t a)
-{
-    asm volatile("outw %w0, %w1" : : "a"(a), "Nd"(p));
-}
-inline void outw(uint16_t p, uint8_t al, uint8_t ah)
-{
-    asm volatile("outw %w0, %w1" : : "a"(al + 256 * ah), "Nd"(p));
-}
-inline uint16_t inw(uint16_t p) 
-{
-    uint16_t a;
-    asm volatile("inw %w1, %w0" : "=a"(a) : "Nd"(p));
-    return a;
-}
-inline void outl(uint16_t p, uint32_t a)
-{
-    asm volatile("outl %0, %w1" : : "a"(a), "Nd"(p));
-}
-inline uint32_t inl(uint16_t p) 
-{
-    uint32_t a;
-    asm volatile("inl %w1, %0" : "=a"(a) : "Nd"(p));
-    return a;
-}
-
 namespace {
-struct Serial
-{
-    static const uint16_t COM1 = 0x3f8;
-    uint16_t port;
-    // outputs a single character to the serial port
-    void putc(char c)
-    {
-        if(c == '\n') putc('\r');
-        while (!(inb(port|5) & 0x20));
-        outb(port, c);
-    }
-    Serial(uint16_t port_=COM1, unsigned speed = 9600)
-        : port(port_)
-    {
-        size_t divisor = 115200 / speed;
-        if(divisor == 0) {
-            divisor = 1;
-        } else if(divisor > 0xffff) {
-            divisor = 0xffff;
-        }
-
-        // for port assignments, see e.g. http://www.lammertbies.nl/comm/info/serial-uart.html
-
-        outb(port|3, 0);          // Set DLAB = 0 (ports 0+1 are data / interrupt registers)
-        outb(port|1, 0);          // Disable all interrupts
-
-        outb(port|3, 0x80);       // Set DLAB = 1 (ports 0+1 are divisor)
-        outw(port|0, uint16_t(divisor));
-
-        outb(port|3, 0x03);       // 8 bits, no parity, one stop bit
-        outb(port|2, 0xC7);  // Enable FIFO, clear them, with 14-byte threshold
-        outb(port|4, 0x0B);  // IRQs enabled, RTS/DSR set
-
-    }
-};
-
 struct VGA
 {
     struct vga_cell_t {
         uint8_t glyph;
         uint8_t attribute;
     };
+    // flush() copies the cells a word at a time
+    typedef uint64_t AliasedWord __attribute__((may_alias));
     static const size_t columns = 80;
     static const size_t rows = 25;
-    vga_cell_t *fb;
+    static const uint32_t all_rows = (uint32_t(1) << rows) - 1;
+    volatile vga_cell_t *fb;
+    // Characters are drawn into shadow, and flush() copies the rows that
+    // have changed to the frame buffer in bulk. Its rows are a ring starting
+    // at top, so scrolling moves no memory until the next flush. It lives
+    // outside the VGA, to keep the console's formatter a reasonable size.
+    vga_cell_t *shadow;
+    size_t top;
+    uint32_t dirty;             // a bit for each screen row changed since flush()
     size_t x, y;
+    size_t cursor;              // where the hardware cursor is
     uint8_t attribute;
 
+    vga_cell_t *row(size_t iy)
+    {
+        return shadow + (top + iy) % rows * columns;
+    }
+    void clear_row(size_t iy)
+    {
+        for(size_t ix = 0; ix < columns; ++ix) {
+            set_cell(ix, iy, ' ', attribute);
+        }
+    }
     void cls(void)
     {
         for(size_t iy = 0; iy < rows; ++iy) {
-            for(size_t ix = 0; ix < columns; ++ix) {
-                set_cell(ix, iy, ' ', attribute);
-            }
+            clear_row(iy);
         }
         x = y = 0;
-        update_cursor();
+        flush();
     }
     void scroll()
     {
-        for(size_t iy = 0; iy < columns; ++iy) {
-            vga_cell_t *to = fb + (iy-1) * columns,
-                * from = fb + iy * columns;
-            for(size_t ix = 0; ix < columns; ++ix) {
-                to[ix] = from[ix];
-            }
-        }
-        for(size_t ix = 0; ix < columns; ++ix) {
-            set_cell(ix, rows-1, ' ', attribute);
-        }
+        top = (top + 1) % rows;
+        clear_row(rows-1);
+        dirty = all_rows;
     }
     void set_cell(size_t _x, size_t _y, uint8_t _glyph, uint8_t _attribute)
     {
-        vga_cell_t *cell = fb + _y*columns + _x;
+        vga_cell_t *cell = row(_y) + _x;
         cell->glyph = _glyph;
         cell->attribute = _attribute;
+        dirty |= uint32_t(1) << _y;
     };
     void update_cursor(void)
     {
         size_t pos = y * columns + x;
+        if(pos == cursor)
+            return;
+        cursor = pos;
         outw(0x3d4, 14, uint8_t(pos>>8));
         outw(0x3d4, 15, uint8_t(pos));
     }
+    // copies the changed rows to the frame buffer, and moves the cursor
+    void flush(void)
+    {
+        static const size_t words = columns * sizeof(vga_cell_t) / sizeof(AliasedWord);
+        for(size_t iy = 0; dirty; ++iy) {
+            uint32_t bit = uint32_t(1) << iy;
+            if(!(dirty & bit))
+                continue;
+            dirty &= ~bit;
+            const AliasedWord *from = reinterpret_cast<const AliasedWord *>(row(iy));
+            volatile AliasedWord *to = reinterpret_cast<volatile AliasedWord *>(fb + iy * columns);
+            for(size_t i = 0; i < words; ++i) {
+                to[i] = from[i];
+            }
+        }
+        update_cursor();
+    }
     void newline(void)
     {
         x = 0;
@@ -139,6 +118,7 @@ struct VGA
         }
     }
 
+    // draws a character in the shadow buffer; call flush() to show it
     void putc(char c) {
         if(c == '\n') {
             newline();
@@ -149,12 +129,12 @@ struct VGA
                 newline();
             }
         }
-        update_cursor();
     }
 
-    VGA(void)
-        : fb(reinterpret_cast<vga_cell_t *>(0xb8000))
-        , x(0), y(0), attribute(0x1f)
+    explicit VGA(vga_cell_t *shadow_)
+        // through the direct map, as AddressSpace::init_tlb() removes the identity map
+        : fb(reinterpret_cast<vga_cell_t *>(0xffff8000000b8000))
+        , shadow(shadow_), top(0), dirty(0), x(0), y(0), cursor(~size_t(0)), attribute(0x1f)
     {
         cls();
     }
@@ -168,47 +148,53 @@ struct VGA
     VGA &operator =(const VGA &) = default;
 };
 
-class SerialFormatter : public Formatter
+//! the console's shadow buffer (see VGA), a page of its own
+VGA::vga_cell_t console_shadow[VGA::rows * VGA::columns] __attribute__((aligned(4096)));
+
+class SerialFormatter : public BufferedFormatter
 {
-    Serial serial;
+    BufferedSerial serial;
     VGA vga;
-    void output(const char *start, const char *end)
+    void sink(const char *start, const char *end)
     {
-        while(start < end) {
-            char c = *start++;
-            vga.putc(c);
-            serial.putc(c);
-        }
+        serial.write(start, end);
+        while(start < end)
+            vga.putc(*start++);
+        vga.flush();
     }
 public:
     SerialFormatter(void)
-        : serial(), vga()
+        : BufferedFormatter(), serial(Serial::COM1, Serial::MAX_BAUD), vga(console_shadow)
     {
     }
+    //! starts draining the serial port from its interrupt
+    bool enable_interrupt(void)
+    {
+        static const unsigned com1_irq = 4;
+        return serial.enable_interrupt(com1_irq, Interrupt::FIRST_IRQ + com1_irq);
+    }
 };
 }
 
 SerialFormatter *console;
 
-
-void kprintf(const char *format, ...)
-{
-    va_list args;
-    va_start(args, format);
-    console->vformat(format, args);
-    va_end(args);
+namespace {
+    /** the early allocator, which keeps track of the memory used while
+        booting until Handover::__kernel_init2() gives it to the Heap */
+    Memblock memblock;
 }
 
+
 extern "C" void *malloc(size_t size) {
     void *allocation = Heap::allocate_bytes(size);
-    kprintf("malloc(%d) = %p\n", size, allocation);
+    EXEC_LOG("malloc(%zu) = %p\n", size, allocation);
     return allocation;
 }
 
 void *operator new(size_t size)
 {
     void *allocation = Heap::allocate_bytes(size);
-    kprintf("operator new(%d) = %p\n", size, allocation);
+    EXEC_LOG("operator new(%zu) = %p\n", size, allocation);
     return allocation;
 }
 void operator delete(void *ptr)
@@ -218,7 +204,7 @@ void operator delete(void *ptr)
 void *operator new[](size_t size)
 {
     void *allocation = Heap::allocate_bytes(size);
-    kprintf("operator new[](%d) = %p\n", size, allocation);
+    EXEC_LOG("operator new[](%zu) = %p\n", size, allocation);
     return allocation;
 }
 void operator delete[](void *ptr)
@@ -228,7 +214,11 @@ void operator delete[](void *ptr)
 
 extern "C" void __cxa_pure_virtual(void)
 {
-    kprintf("PANIC! Called pure virtual function\n");
+    // this may be too early for there to be a console
+    if(console) {
+        Log::flush(*console);
+        EXEC_FORMAT(*console, "PANIC! Called pure virtual function\n");
+    }
     asm volatile("cli\nhlt");
 }
 extern "C" void __cxa_atexit(void) {
@@ -237,98 +227,82 @@ extern "C" void __cxa_atexit(void) {
 void *__dso_handle = reinterpret_cast<void *>(&__dso_handle);
 void __assert_fail(const char *assertion, const char *file, unsigned line, const char *function)
 {
-    kprintf(
-        "\033[1m%s:%d: \033[31merror:\033[0;1m assertion '\033[32m%s\033[0;1m' failed\033[0m\n"
-        "    in \033[33m%s\033[0m\n", file, line, assertion, function);
+    if(console) {
+        Log::flush(*console);
+        EXEC_FORMAT(
+            *console,
+            "\033[1m%s:%d: \033[31merror:\033[0;1m assertion '\033[32m%s\033[0;1m' failed\033[0m\n"
+            "    in \033[33m%s\033[0m\n", file, line, assertion, function);
+    }
     asm volatile("cli\nhlt");
     for(;;);
 }
 
 
 extern char __kernel_start, __kernel_code_end, __kernel_data_end, __kernel_bss_end;
+extern char __kernel_init_start, __kernel_init_end;
 
-char *Handover::__kernel_init(void)
+EXEC_INIT char *Handover::__kernel_init(void)
 {
-    SerialFormatter console_;
-    console = &console_;
-    //kprintf("%s\n", __PRETTY_FUNCTION__);
-    kprintf("masala86: 64 bit mode booting...\n");
-    kprintf("Handover at %p\n", this);
-    kprintf("Kernel at %p, code end %p, data end %p, bss end %p\n",
+    TSC::set_boot(boot_start_tsc);
+    BootProfile::mark("boot_entry", boot_start_tsc);
+    BootProfile::mark("boot_init", boot_init_tsc);
+    BootProfile::mark("kernel_init");
+    String::init();
+
+    // the console outlives this function (and the boot stack), but static
+    // constructors haven't been run yet
+    static char console_memory[sizeof(SerialFormatter)] __attribute__((aligned(16)));
+    console = new (console_memory) SerialFormatter;
+    //EXEC_FORMAT(*console, "%s\n", __PRETTY_FUNCTION__);
+    EXEC_FORMAT(*console, "masala86: 64 bit mode booting...\n");
+    EXEC_FORMAT(*console, "Handover at %p\n", this);
+    EXEC_FORMAT(*console, "Kernel at %p, code end %p, data end %p, bss end %p\n",
              &__kernel_start, &__kernel_code_end, &__kernel_data_end, &__kernel_bss_end
          );
 
-    uintptr_t
-        kernel_virt = 0xffffffff80000000,
-        heap_virt   = 0xffff800000000000,
-        kvirt_start = uintptr_t(&__kernel_start) - kernel_virt + heap_virt,
-        kvirt_end = uintptr_t(&__kernel_bss_end) - kernel_virt + heap_virt,
-        heap24_top  = heap_virt + (1UL<<24),
-        heap32_top  = heap_virt + (1UL<<32);
-        
-    //k2h = kernel_map - heap_virt;
-    
-    // find the highest (physical) address that is RAM. This ultimately decides
-    // how large the Heap::Impl's embedded Page[] structure will be. We also
-    // update the addresses in the E820 maps to contain virtual addresses and
-    // skip the heap space occupied by the kernel.
-    uintptr_t ramtop = 0;       // this is a *physical* address
-    for(size_t i = 0; i < e820_zone_count; ++i) {
-        uintptr_t
-            begin = e820_zones[i].base + heap_virt,
-            end = begin + e820_zones[i].length;
-        //! \bug The kernel lands in the middle of a zone and we lose the front half of that address space as a result
-        if(begin <= kvirt_start && kvirt_end <= end) {
-            begin = kvirt_end;
-        }
-        if(e820_zones[i].type == E820::RAM && end > ramtop)
-            ramtop = end;
-        e820_zones[i].base = begin;
-        e820_zones[i].length = end - begin;
-    }
+    // CPU 0's per-processor variables are the ones in the kernel image
+    PerCPU::init_cpu(CPU::BOOT_CPU);
 
-    // We now need to figure out where to actually drop the Heap::Impl. This is
-    // a potentially large object because it contains a large number of
-    // trailing Page[] objects. Optimally, it should go into the
-    // highest-priority Heap::Zone, but of course we haven't created those
-    // structures yet. It is also possible that the Heap::Impl is larger than
-    // one of the zones (as they occupy 64MiB per 4GiB of memory, assuming
-    // sizeof(Page)==64).
-
-    // We go for an utterly disgusting hack approach that should at least do
-    // the job. We do a speculative placement of the Heap::Zone at the start of
-    // each usable bit of E820 RAM, and pick the one with the highest address.
-
-    uintptr_t heap_impl = 0;
-    for(size_t i = 0; i < e820_zone_count; ++i) {
-        uintptr_t
-            begin = e820_zones[i].base,
-            end = begin + e820_zones[i].length;
-        if(
-            e820_zones[i].type == E820::RAM // only try real RAM
-            && begin > heap_impl // and this RAM is higher than the existing candidate
-            ) {
-            Heap::Init init(
-                reinterpret_cast<char *>(heap_virt), // start of physical RAM
-                reinterpret_cast<char *>(ramtop),   // end of physical RAM
-                reinterpret_cast<char *>(begin),    // start of candidate zone
-                3                                   // max 3 zones
-                );
-            if(init.alloc_end < reinterpret_cast<char *>(end))
-                heap_impl = begin;
-        }
-     }
+    // the bootloader has already programmed the PAT, but we need our own copy
+    // of the MTRRs for creating mappings
+    MemoryType::init();
+    AddressSpace::init();
 
-    //! \bug fixme
-    assert(heap_impl);          // we did find somewhere to drop the heap, right?
+    uintptr_t
+        heap_virt   = 0xffff800000000000,
+        heap24_top  = 1UL<<24,  // these are *physical* addresses
+        heap32_top  = 1UL<<32;
+
+    // Seed the early allocator with the RAM from the E820 map, and reserve
+    // what is already in use: everything below 16MiB (the bootloader, the
+    // kernel image, which is mapped where the bootloader was loaded, and its
+    // BSS, our page tables and stack and this Handover). These are
+    // reclaimed by __kernel_init2().
+    memblock.add_e820(&e820_zones[0], &e820_zones[0] + e820_zone_count);
+    memblock.reserve(0, heap24_top);
+    uintptr_t ramtop = memblock.end();
+
+    // The Heap::Impl is a potentially large object because of its trailing
+    // Page[] array (64MiB per 4GiB of memory, assuming sizeof(Page)==64), so
+    // find out how big it is and take it from the top of memory.
+    size_t heap_impl_size = Heap::Init(
+        reinterpret_cast<char *>(heap_virt),          // start of physical RAM
+        reinterpret_cast<char *>(heap_virt + ramtop), // end of physical RAM
+        reinterpret_cast<char *>(heap_virt),          // placeholder address
+        3                                             // max 3 zones
+        ).bytes();
+    uintptr_t heap_impl = memblock.allocate(heap_impl_size, Heap::PAGE_SIZE);
+    assert(heap_impl && "no room for the heap");
     Heap::Init init(
-        reinterpret_cast<char *>(heap_virt),  // start of physical RAM
-        reinterpret_cast<char *>(ramtop),    // end of physical RAM
-        reinterpret_cast<char *>(heap_impl),    // start of candidate zone
-        3                                       // max 3 zones
+        reinterpret_cast<char *>(heap_virt),
+        reinterpret_cast<char *>(heap_virt + ramtop),
+        reinterpret_cast<char *>(heap_virt + heap_impl),
+        3
         );
 
     // init the heap...
+    BootProfile::mark("heap_create");
     Heap::Impl::create(init);
     //Heap::dump(*console);
 
@@ -338,8 +312,8 @@ char *Handover::__kernel_init(void)
     if(ramtop > heap32_top) {
         zone64 = new (init.next_zone()) Heap::Zone(
             "High RAM", 0,
-            init.pfn(reinterpret_cast<char *>(heap32_top)),
-            init.pfn(reinterpret_cast<char *>(ramtop)),
+            init.pfn(reinterpret_cast<char *>(heap_virt + heap32_top)),
+            init.pfn(reinterpret_cast<char *>(heap_virt + ramtop)),
             Heap::REQ_ANY
             );
         Heap::heap->zones.enqueue(zone64);
@@ -347,8 +321,8 @@ char *Handover::__kernel_init(void)
 
     zone32 = new (init.next_zone()) Heap::Zone(
         "RAM", -10,
-        init.pfn(reinterpret_cast<char *>(heap24_top)),
-        init.pfn(reinterpret_cast<char *>(min(heap32_top, ramtop))),
+        init.pfn(reinterpret_cast<char *>(heap_virt + heap24_top)),
+        init.pfn(reinterpret_cast<char *>(heap_virt + min(heap32_top, ramtop))),
         Heap::REQ_DMA32
         );
     Heap::heap->zones.enqueue(zone32);
@@ -356,51 +330,29 @@ char *Handover::__kernel_init(void)
     zone24 = new (init.next_zone()) Heap::Zone(
         "ISA RAM", -10,
         init.pfn(reinterpret_cast<char *>(heap_virt)),
-        init.pfn(reinterpret_cast<char *>(heap24_top)),
+        init.pfn(reinterpret_cast<char *>(heap_virt + heap24_top)),
         Heap::REQ_DMA24 | Heap::REQ_DMA32
         );
     Heap::heap->zones.enqueue(zone24);
 
-
     // At this point, we now have the heap data structures initialised. The
     // only catch is that all of the memory is still marked as in-use! So we
-    // now go through the E820 maps and free the memory, making sure that we
-    // don't also free the memory occupied by the heap data structure.
-
-    /** \todo Note that zone24 still contains our page tables, stack, etc!
-
-        We basically assume that freeing the memory does not corrupt it - true
-        with our current buddy allocator that keeps its management data
-        out-of-line - but need this to be guaranteed. As it is, we temporarily
-        remove zone24 from the list of zones immediately after releasing the
-        memory indicated in the E820 maps, to be added back later when we've
-        sorted everything out.
-    */
-
-    for(size_t i = 0; i < e820_zone_count; ++i) {
-        if(e820_zones[i].type == E820::RAM) {
-            uintptr_t
-                begin = e820_zones[i].base,
-                end = begin + e820_zones[i].length,
-                init_end = uintptr_t(init.alloc_end);
-            if(begin <= init_end && init_end <= end) {
-                begin = init_end;
-            }
-            Heap::PFN
-                pfn_begin = init.pfn(round_up(reinterpret_cast<char *>(begin), Heap::PAGE_SIZE)),
-                pfn_end = init.pfn(round_down(reinterpret_cast<char *>(end), Heap::PAGE_SIZE));
-            kprintf("[%p, %p) [%d, %d]\n", begin, end, pfn_begin, pfn_end);
-            Heap::heap->release_range(pfn_begin, pfn_end);
-        }
-    }
+    // now hand everything the Memblock hasn't reserved over to the buddy
+    // allocator in one pass. zone24 is still wholly reserved, so it stays
+    // empty until __kernel_init2().
 
-    Heap::heap->zones.remove(zone24);
+    BootProfile::mark("zone_release");
+    memblock.for_each_free([&](Memblock::Address begin, Memblock::Address end) {
+            Heap::PFN
+                pfn_begin = init.pfn(round_up(reinterpret_cast<char *>(heap_virt + begin), Heap::PAGE_SIZE)),
+                pfn_end = init.pfn(round_down(reinterpret_cast<char *>(heap_virt + end), Heap::PAGE_SIZE));
+            if(pfn_begin < pfn_end)
+                Heap::heap->release_range(pfn_begin, pfn_end);
+        });
 
+    memblock.dump(*console);
     Heap::dump(*console);
-    kprintf("exiting %s\n", __PRETTY_FUNCTION__);
-
-    // FIXME: to do: move kernel page tables to high memory. Add *all* higher
-    // memory zones to the memory pool.
+    EXEC_FORMAT(*console, "exiting %s\n", __PRETTY_FUNCTION__);
 
     //char *stacktoo = new char[4096]; // allocator breaker
     char *stack = new char[4096];
@@ -413,7 +365,67 @@ char *Handover::__kernel_init(void)
 
 void Handover::__kernel_init2(void)
 {
-    asm("hlt");
+    BootProfile::mark("kernel_init2");
+    // we're now on our own stack, so the identity map can go
+    AddressSpace::init_tlb();
+
+    // Now reclaim the memory below 16MiB that was used while booting: the
+    // bootloader and its page tables, the boot stack, this Handover and the
+    // kernel's .init section. The page tables move first, so that nothing
+    // live is left down there apart from the kernel image (which is mapped
+    // in place) and the BIOS scratch area.
+    BootProfile::mark("reclaim");
+    static const Memblock::Address
+        isa_top = 1 << 24,
+        bios_scratch = 64 << 10; // real-mode IVT, BDA and the AP trampoline
+    AddressSpace &kernel = AddressSpace::kernel();
+    PageTable::Physical old_l4 = kernel.root();
+    kernel.relocate();
+    memblock.release(0, isa_top);
+    memblock.reserve(0, bios_scratch);
+
+    PageTable tables(kernel.root());
+    char *image_end = round_up(&__kernel_bss_end, Heap::PAGE_SIZE);
+    for(char *page = &__kernel_start; page < image_end; page += Heap::PAGE_SIZE) {
+        if(page >= &__kernel_init_start && page < &__kernel_init_end)
+            continue;
+        PageTable::Physical physical;
+        bool mapped = tables.translate(page, physical);
+        assert(mapped && "kernel image not mapped");
+        (void)mapped;
+        memblock.reserve(physical, physical + Heap::PAGE_SIZE);
+    }
+    // nothing may call into .init after this
+    kernel.unmap(&__kernel_init_start, size_t(&__kernel_init_end - &__kernel_init_start));
+
+    memblock.for_each_free([&](Memblock::Address begin, Memblock::Address end) {
+            // the ranges above 16MiB were released by __kernel_init()
+            begin = round_up(begin, Memblock::Address(Heap::PAGE_SIZE));
+            end = round_down(min(end, isa_top), Memblock::Address(Heap::PAGE_SIZE));
+            if(begin < end)
+                Heap::heap->release_range(
+                    Heap::PFN((PageTable::virt(begin) - Heap::heap->start) >> Heap::PAGE_SHIFT),
+                    Heap::PFN((PageTable::virt(end) - Heap::heap->start) >> Heap::PAGE_SHIFT));
+        });
+    EXEC_FORMAT(*console, "reclaimed boot memory, page tables moved from %#llx to %#llx\n",
+            old_l4, kernel.root());
+    Heap::dump(*console);
+    AddressSpace::dump(*console);
+
+    Interrupt::init(*console);
+    Interrupt::init_cpu(CPU::BOOT_CPU);
+    FPU::init();
+
+    BootProfile::mark("start_aps");
+    CPU::start_aps();
+    CPU::dump(*console);
+    BootProfile::dump(*console);
+
+    if(IOAPIC::init())
+        console->enable_interrupt();
+    static const unsigned timer_hz = 100;
+    if(LocalAPIC::start_timer(timer_hz))
+        Interrupt::enable();
     //console->format("%s\n", __PRETTY_FUNCTION__);
 }
 
@@ -427,4 +439,11 @@ void Handover::__kernel_run(void)
 {
     // static_test_console.format("%s\n", __PRETTY_FUNCTION__);
     // Heap::dump(static_test_console);
+
+    // there's no scheduler yet, so just take interrupts, and print what
+    // they log
+    for(;;) {
+        asm volatile("hlt");
+        Log::flush(*console);
+    }
 }
@@ -0,0 +1,163 @@
+// -*- mode: c++ -*-
+/**
+   \brief Kernel log (implementation)
+   \file
+*/
+
+#include <stddef.h>
+
+#include "exec/format.hpp"
+#include "exec/log.hpp"
+#include "exec/tsc.hpp"
+
+using namespace exec;
+
+/** \defgroup exec_log Log: the kernel log
+
+    Formatting a message and writing it to the console is slow, and
+    impossible before the console exists. #EXEC_LOG instead records the
+    message's format and parameters (as integers, see Formatter::replay()),
+    with the time stamp counter, in the calling processor's ring, which
+    costs about as much as a function call. flush() formats the records
+    later, from the idle loop or when panicking, merging the rings in time
+    stamp order and printing the times relative to the start of the
+    bootloader (see TSC::since_boot()).
+
+    Each ring is only written by its own processor, so a record is claimed
+    by incrementing the per-processor count of records written in one
+    instruction (see PerCPU::fetch_add()), which an interrupt can't split,
+    and no lock is needed. CPU 0's ring is in the kernel image, so it can be
+    used from the start; the other processors' are reset by init_cpu()
+    before use, as they start as copies of CPU 0's.
+
+    A record's sequence number is zeroed before it's written and set to its
+    index plus one afterwards, so the reader, which may be on any processor,
+    can tell a record that's still being written (or has been overwritten
+    while it was being copied) from a complete one. The reader doesn't hold
+    the writers up, so when a ring fills up its oldest records are
+    overwritten, and flush() reports how many were lost.
+
+    \bug the rings only hold #RING_SIZE records, so that each fits in a page
+    of the per-processor area.
+
+    \bug strings are recorded as pointers, so a message's strings must
+    outlive it.
+
+    @{
+*/
+
+Log::Record Log::ring[Log::RING_SIZE] EXEC_PERCPU;
+uint64_t Log::written EXEC_PERCPU = 0;
+uint32_t Log::cpus = 1 << CPU::BOOT_CPU;
+uint64_t Log::read[CPU::MAX_CPUS];
+Log::Record Log::pending[CPU::MAX_CPUS];
+bool Log::reading = false;
+
+/** @} */
+
+
+
+/* ====================================================================== */
+/** \brief writes a record to the ring of the processor we're running on
+    \param format the output format
+    \param values the parameters
+    \param count the number of parameters */
+void Log::append(const char *format, const uintmax_t *values, size_t count)
+{
+    uint64_t index = PerCPU::fetch_add(written, uint64_t(1));
+    Record &record = PerCPU::pointer(ring[0])[index % RING_SIZE];
+    __atomic_store_n(&record.sequence, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    record.tsc = rdtsc();
+    record.format = format;
+    record.count = count;
+    for(size_t i = 0; i < count; ++i)
+        record.args[i] = values[i];
+    __atomic_store_n(&record.sequence, index + 1, __ATOMIC_RELEASE);
+}
+/** \brief resets the ring of the processor we're running on, and makes it
+    visible to flush()
+
+    Its per-processor variables must already be set up (see PerCPU).
+    \param cpu the processor we're running on */
+void Log::init_cpu(CPU::ID cpu)
+{
+    Record *records = PerCPU::pointer(ring[0]);
+    for(size_t i = 0; i < RING_SIZE; ++i)
+        records[i].sequence = 0;
+    PerCPU::write(written, uint64_t(0));
+    read[cpu] = 0;
+    __atomic_or_fetch(&cpus, uint32_t(1) << cpu, __ATOMIC_RELEASE);
+}
+/** \brief copies the next complete record from a processor's ring
+    \param cpu the processor
+    \param copy where to copy it
+    \returns false if there isn't one */
+bool Log::next(CPU::ID cpu, Record &copy)
+{
+    const Record *records = PerCPU::pointer(ring[0], cpu);
+    uint64_t head = __atomic_load_n(PerCPU::pointer(written, cpu), __ATOMIC_ACQUIRE);
+    uint64_t &tail = read[cpu];
+    if(head - tail > RING_SIZE)
+        tail = head - RING_SIZE;
+    while(tail != head) {
+        const Record &record = records[tail % RING_SIZE];
+        uint64_t sequence = __atomic_load_n(&record.sequence, __ATOMIC_ACQUIRE);
+        if(sequence < tail + 1)
+            return false;       // still being written
+        if(sequence == tail + 1) {
+            copy.tsc = record.tsc;
+            copy.format = record.format;
+            copy.count = record.count;
+            for(size_t i = 0; i < MAX_ARGS; ++i)
+                copy.args[i] = record.args[i];
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if(__atomic_load_n(&record.sequence, __ATOMIC_RELAXED) == sequence) {
+                copy.sequence = sequence;
+                ++tail;
+                return true;
+            }
+        }
+        // overwritten: skip it, and count it as lost
+        ++tail;
+    }
+    return false;
+}
+/** \brief formats and prints every complete record, oldest first
+
+    Only one processor reads at a time; if another already is, this returns
+    straight away.
+    \param formatter where to print them */
+void Log::flush(Formatter &formatter)
+{
+    if(__atomic_exchange_n(&reading, true, __ATOMIC_ACQUIRE))
+        return;
+    uint32_t active = __atomic_load_n(&cpus, __ATOMIC_ACQUIRE), waiting = 0;
+    uint64_t lost = 0;
+    for(CPU::ID cpu = 0; cpu < CPU::MAX_CPUS; ++cpu) {
+        uint64_t before = read[cpu];
+        if((active & (uint32_t(1) << cpu)) && next(cpu, pending[cpu]))
+            waiting |= uint32_t(1) << cpu;
+        lost += read[cpu] - before - ((waiting >> cpu) & 1);
+    }
+    while(waiting) {
+        CPU::ID oldest = CPU::MAX_CPUS;
+        for(CPU::ID cpu = 0; cpu < CPU::MAX_CPUS; ++cpu)
+            if((waiting & (uint32_t(1) << cpu)) &&
+               (oldest == CPU::MAX_CPUS || pending[cpu].tsc < pending[oldest].tsc))
+                oldest = cpu;
+
+        const Record &record = pending[oldest];
+        uint64_t us = TSC::to_us(TSC::since_boot(record.tsc));
+        EXEC_FORMAT(formatter, "[%5llu.%06llu %2u] ", us / 1000000, us % 1000000, oldest);
+        formatter.replay(record.format, record.args, size_t(record.count));
+
+        uint64_t before = read[oldest];
+        if(!next(oldest, pending[oldest]))
+            waiting &= ~(uint32_t(1) << oldest);
+        lost += read[oldest] - before - ((waiting >> oldest) & 1);
+    }
+    if(lost)
+        EXEC_FORMAT(formatter, "[log: %llu records lost]\n", lost);
+    __atomic_store_n(&reading, false, __ATOMIC_RELEASE);
+}
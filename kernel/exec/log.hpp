@@ -0,0 +1,92 @@
+// -*- mode: c++ -*-
+/**
+   \brief Kernel log (headers)
+   \file
+*/
+
+#ifndef EXEC_LOG_HPP
+#define EXEC_LOG_HPP
+
+/** \addtogroup exec_log
+    @{ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "exec/cpu.hpp"
+#include "exec/format.hpp"
+#include "exec/percpu.hpp"
+#include "exec/types.hpp"
+#include "exec/x86.hpp"
+
+/** \brief a per-processor ring of log records, formatted when they are
+    read rather than when they are written */
+class exec::Log {
+public:
+    static const size_t MAX_ARGS = 4; //!< most parameters a record holds
+private:
+    static const size_t RING_SIZE = 64; //!< records in each ring, a power of two
+
+    //! a message, as its format and parameters
+    struct Record {
+        uint64_t sequence;      //!< the record's index plus one once written, or 0 while being written
+        uint64_t tsc;           //!< the time stamp counter when it was written
+        const char *format;     //!< the format, a string literal
+        uint64_t count;         //!< the number of parameters
+        uintmax_t args[MAX_ARGS]; //!< the parameters (see Formatter::replay())
+    };
+
+    static Record ring[RING_SIZE]; //!< (per-processor) the processor's records
+    static uint64_t written;    //!< (per-processor) the number of records ever started
+    static uint32_t cpus;       //!< the processors whose rings are in use, as a bitmask
+    static uint64_t read[CPU::MAX_CPUS]; //!< the number of each processor's records read
+    static Record pending[CPU::MAX_CPUS]; //!< the next record read from each ring
+    static bool reading;        //!< whether a processor is in flush()
+
+    // the parameters, converted as Formatter::print() would
+    static uintmax_t value(char v) { return uintmax_t(intmax_t(v)); }
+    static uintmax_t value(signed char v) { return uintmax_t(intmax_t(v)); }
+    static uintmax_t value(short v) { return uintmax_t(intmax_t(v)); }
+    static uintmax_t value(int v) { return uintmax_t(intmax_t(v)); }
+    static uintmax_t value(long v) { return uintmax_t(intmax_t(v)); }
+    static uintmax_t value(long long v) { return uintmax_t(intmax_t(v)); }
+    static uintmax_t value(bool v) { return v; }
+    static uintmax_t value(unsigned char v) { return v; }
+    static uintmax_t value(unsigned short v) { return v; }
+    static uintmax_t value(unsigned v) { return v; }
+    static uintmax_t value(unsigned long v) { return v; }
+    static uintmax_t value(unsigned long long v) { return v; }
+    static uintmax_t value(const void *v) { return reinterpret_cast<uintptr_t>(v); }
+
+    static void append(const char *, const uintmax_t *, size_t);
+    static bool next(CPU::ID, Record &);
+public:
+    /** \brief records a message on the processor we're running on
+        \param format the output format (see Formatter::vformat()), which
+        should be checked against the arguments with #EXEC_LOG
+        \param args the parameters; strings are recorded as pointers, so
+        they must outlive the record */
+    template <typename... Args> static void write(const char *format, const Args &... args)
+    {
+        static_assert(sizeof...(Args) <= MAX_ARGS, "too many parameters to log");
+        const uintmax_t values[] = { value(args)..., 0 };
+        append(format, values, sizeof...(Args));
+    }
+    static void init_cpu(CPU::ID);
+    static void flush(Formatter &);
+};
+
+/** \brief records a message in the Log, checking at compile time that the
+    format (which must be a string literal) matches the arguments
+    \param format_ the output format (see Formatter::vformat())
+    \param ... the parameters */
+#define EXEC_LOG(format_, ...)                                          \
+    do {                                                                \
+        static_assert(decltype(::exec::formatcheck::check(__VA_ARGS__))::valid(format_), \
+                      "format doesn't match its arguments: " format_);  \
+        ::exec::Log::write(format_, ##__VA_ARGS__);                     \
+    } while(0)
+
+/** @} */
+
+#endif
@@ -0,0 +1,176 @@
+// -*- mode: c++ -*-
+/**
+   \brief Early boot memory allocator (implementation)
+   \file
+*/
+
+#include <assert.h>
+#include <stddef.h>
+
+#include "exec/format.hpp"
+#include "exec/init.hpp"
+#include "exec/memblock.hpp"
+#include "exec/util.hpp"
+
+using namespace exec;
+
+/** \defgroup exec_memblock Memblock: early boot memory allocation
+
+    The Heap needs memory for its own data structures before it can allocate
+    anything, and the bootloader needs memory for page tables before there is
+    anywhere to put a Heap. Both of these are solved by Memblock, a very simple
+    allocator which just keeps a sorted list of ranges of RAM (seeded from the
+    E820 map) and a sorted list of ranges that are reserved, either because
+    something was already there (the kernel, the BIOS data area, ...) or
+    because they have been allocated.
+
+    Allocations are made top-down from the highest free range that fits, which
+    keeps early allocations away from the scarcer low memory. Once the Heap
+    exists, the free ranges are handed to it in a single pass with
+    for_each_free(). The memory used while booting is handed over in a second
+    pass once the kernel has initialised, after which the Memblock is no
+    longer needed and its code (in the .init section) is freed too.
+
+    @{
+*/
+
+/** @} */
+
+
+
+/* ====================================================================== */
+/** \brief adds a range to a sorted range list, merging with any ranges it overlaps or abuts
+    \param ranges the range list
+    \param count the number of entries in the range list
+    \param begin the start of the new range
+    \param end one-past-end of the new range */
+EXEC_INIT void Memblock::insert(Range *ranges, size_t &count, Address begin, Address end)
+{
+    if(begin >= end)
+        return;
+    // ranges [first, last) overlap or abut the new range
+    size_t first = 0;
+    while(first < count && ranges[first].end < begin)
+        ++first;
+    size_t last = first;
+    while(last < count && ranges[last].begin <= end)
+        ++last;
+    if(first < last) {
+        begin = min(begin, ranges[first].begin);
+        end = max(end, ranges[last - 1].end);
+    }
+
+    // replace [first, last) with the single new range
+    if(first == last) {
+        assert(count < MAX_RANGES && "Memblock range list full");
+        for(size_t i = count; i > first; --i)
+            ranges[i] = ranges[i - 1];
+        ++count;
+    } else {
+        size_t removed = last - first - 1;
+        for(size_t i = first + 1; i + removed < count; ++i)
+            ranges[i] = ranges[i + removed];
+        count -= removed;
+    }
+    ranges[first].begin = begin;
+    ranges[first].end = end;
+}
+/** \brief removes a range from a sorted range list, splitting any range it falls within
+    \param ranges the range list
+    \param count the number of entries in the range list
+    \param begin the start of the range to remove
+    \param end one-past-end of the range to remove */
+EXEC_INIT void Memblock::remove(Range *ranges, size_t &count, Address begin, Address end)
+{
+    size_t i = 0;
+    while(i < count) {
+        Range &range = ranges[i];
+        if(range.end <= begin || range.begin >= end) {
+            ++i;                // no overlap
+        } else if(range.begin < begin && range.end > end) {
+            // split in two
+            assert(count < MAX_RANGES && "Memblock range list full");
+            for(size_t j = count; j > i + 1; --j)
+                ranges[j] = ranges[j - 1];
+            ++count;
+            ranges[i + 1].begin = end;
+            ranges[i + 1].end = range.end;
+            range.end = begin;
+            return;
+        } else if(range.begin < begin) {
+            range.end = begin;  // trim the tail
+            ++i;
+        } else if(range.end > end) {
+            range.begin = end;  // trim the head
+            ++i;
+        } else {
+            // wholly covered, so delete it
+            for(size_t j = i; j + 1 < count; ++j)
+                ranges[j] = ranges[j + 1];
+            --count;
+        }
+    }
+}
+
+
+
+/* ====================================================================== */
+/** \brief adds a range of RAM
+    \param begin the start of the RAM
+    \param end one-past-end of the RAM */
+EXEC_INIT void Memblock::add(Address begin, Address end)
+{
+    insert(memory, memory_count, begin, end);
+}
+/** \brief removes a range from the RAM, if it was there
+    \param begin the start of the range
+    \param end one-past-end of the range */
+EXEC_INIT void Memblock::exclude(Address begin, Address end)
+{
+    remove(memory, memory_count, begin, end);
+}
+/** \brief marks a range of RAM as in use
+    \param begin the start of the range
+    \param end one-past-end of the range */
+EXEC_INIT void Memblock::reserve(Address begin, Address end)
+{
+    insert(reserved, reserved_count, begin, end);
+}
+/** \brief marks a range of RAM as free again
+    \param begin the start of the range
+    \param end one-past-end of the range */
+EXEC_INIT void Memblock::release(Address begin, Address end)
+{
+    remove(reserved, reserved_count, begin, end);
+}
+/** \brief allocates and reserves a range of RAM
+    \param size the number of bytes to allocate
+    \param alignment the required alignment, which must be a power of two
+    \param limit the allocation must end at or below this address
+    \returns the address of the allocation, or 0 on failure (address 0 is
+    never allocated as it holds the real-mode IVT) */
+EXEC_INIT Memblock::Address Memblock::allocate(Address size, Address alignment, Address limit)
+{
+    Address found = 0;
+    // the free ranges are visited in ascending order, so the last fit is the highest
+    for_each_free([&](Address begin, Address end) {
+            end = min(end, limit);
+            if(end < begin + size)
+                return;
+            Address candidate = round_down(end - size, alignment);
+            if(candidate >= begin && candidate)
+                found = candidate;
+        });
+    if(found)
+        reserve(found, found + size);
+    return found;
+}
+EXEC_INIT void Memblock::dump(Formatter &formatter) const
+{
+    EXEC_FORMAT(formatter, "Memblock RAM:\n");
+    for(size_t i = 0; i < memory_count; ++i)
+        EXEC_FORMAT(formatter, "  [%#'llx, %#'llx)\n", memory[i].begin, memory[i].end);
+    EXEC_FORMAT(formatter, "Memblock reserved:\n");
+    for(size_t i = 0; i < reserved_count; ++i)
+        EXEC_FORMAT(formatter, "  [%#'llx, %#'llx)\n", reserved[i].begin, reserved[i].end);
+}
@@ -0,0 +1,104 @@
+// -*- mode: c++ -*-
+/**
+   \brief Early boot memory allocator (headers)
+   \file
+*/
+
+#ifndef EXEC_MEMBLOCK_HPP
+#define EXEC_MEMBLOCK_HPP
+
+/** \addtogroup exec_memblock
+    @{ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "exec/handover.hpp"
+#include "exec/types.hpp"
+#include "exec/util.hpp"
+
+/** \brief region-based allocator for use before the Heap exists
+
+    \note This is used by both the 32 bit bootloader and the 64 bit kernel, so
+    addresses are always 64 bit physical addresses rather than pointers.
+*/
+class exec::Memblock {
+public:
+    typedef uint64_t Address;   //!< a physical address
+    //! a half-open range of physical addresses [begin, end)
+    struct Range {
+        Address begin;          //!< first address in the range
+        Address end;            //!< one-past-last address in the range
+    };
+private:
+    static const size_t MAX_RANGES = 64; //!< capacity of each of #memory and #reserved
+    static const Address PAGE_SIZE = 4096; //!< granularity of the RAM added from a memory map
+
+    Range memory[MAX_RANGES];   //!< sorted, disjoint ranges of RAM
+    size_t memory_count;        //!< number of entries in #memory
+    Range reserved[MAX_RANGES]; //!< sorted, disjoint ranges of reserved RAM
+    size_t reserved_count;      //!< number of entries in #reserved
+
+    static void insert(Range *, size_t &, Address, Address);
+    static void remove(Range *, size_t &, Address, Address);
+public:
+    //! constructs an empty Memblock (constexpr so that it can be a static before constructors are run)
+    constexpr Memblock(void)
+        : memory(), memory_count(0), reserved(), reserved_count(0)
+    {}
+
+    void add(Address, Address);
+    void exclude(Address, Address);
+    void reserve(Address, Address);
+    void release(Address, Address);
+    Address allocate(Address, Address, Address=~Address(0));
+    //! \returns one-past-end address of the highest RAM
+    Address end(void) const { return memory_count ? memory[memory_count - 1].end : 0; }
+    void dump(Formatter &) const;
+
+    /** \brief adds the RAM described by an E820 memory map
+
+        Firmware memory maps may be unsorted, and their entries may overlap
+        or not be page-aligned. The RAM entries are shrunk to whole pages and
+        added first; then everything else in the map is rounded out to whole
+        pages and excluded, so that any other type takes precedence over RAM
+        wherever the two overlap.
+
+        \param begin iterator to the first Handover::E820 entry
+        \param end one-past-end iterator */
+    template <typename I> void add_e820(I begin, I end)
+    {
+        for(I zone = begin; zone != end; ++zone)
+            if(zone->type == Handover::E820::RAM)
+                add(round_up(zone->base, PAGE_SIZE), round_down(zone->base + zone->length, PAGE_SIZE));
+        for(I zone = begin; zone != end; ++zone)
+            if(zone->type != Handover::E820::RAM)
+                exclude(round_down(zone->base, PAGE_SIZE), round_up(zone->base + zone->length, PAGE_SIZE));
+    }
+
+    /** \brief calls a function for each range of RAM that is not reserved
+        \param function the function to call with the start and one-past-end
+        addresses of each free range, in ascending order */
+    template <typename F> void for_each_free(F function) const
+    {
+        size_t r = 0;
+        for(size_t m = 0; m < memory_count; ++m) {
+            Address begin = memory[m].begin;
+            // skip reservations wholly below this range of memory
+            while(r < reserved_count && reserved[r].end <= begin)
+                ++r;
+            for(size_t i = r; i < reserved_count && reserved[i].begin < memory[m].end; ++i) {
+                if(reserved[i].begin > begin)
+                    function(begin, reserved[i].begin);
+                if(reserved[i].end > begin)
+                    begin = reserved[i].end;
+            }
+            if(begin < memory[m].end)
+                function(begin, memory[m].end);
+        }
+    }
+};
+
+/** @} */
+
+#endif
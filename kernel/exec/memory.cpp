@@ -6,11 +6,14 @@
 
 #include <assert.h>
 #include <new>
+#include <string.h>
 
 #include "exec/format.hpp"
+#include "exec/init.hpp"
 #include "exec/memory.hpp"
 #include "exec/memory_priv.hpp"
 #include "exec/util.hpp"
+#include "exec/vheap.hpp"
 
 using namespace exec;
 
@@ -81,6 +84,9 @@ static const size_t CACHE_ALIGN = 64;
 //! the system heap (singleton)
 Heap::Impl *Heap::heap = NULL;
 
+Cache::Local *Cache::Impl::chunks[Cache::Impl::MAX_CHUNKS] EXEC_PERCPU;
+uint64_t Cache::Impl::slots_used[(Cache::Impl::MAX_SLOTS + 63) / 64];
+
 /** @} */
 
 
@@ -230,7 +236,9 @@ Page::Page(void)
 
 /* ====================================================================== */
 Cache::Slab::Slab(Cache::Impl *cache_, char *first_object_, size_t count)
-    : cache(cache_), first_object(first_object_), active_count(0), first_free(0)
+    : cache(cache_), first_object(first_object_)
+    , remote_next(NULL), owner(CPU::current())
+    , active_count(0), first_free(0), remote_free(END_OF_LIST)
 {
     assert(count <= MAX_INDEX);
     free_list[count - 1] = END_OF_LIST;
@@ -261,19 +269,22 @@ Cache::Impl::Impl(
     const char *name_, int priority_,
     size_t size_, size_t alignment_, Flags flags_, Heap::Requirements requirements_
     ) : Node(name_, priority_)
+      , flags(flags_)
       , refcount(1)
       , size(size_)
       , alignment(alignment_)
-      , flags(flags_)
       , count(1)
-      , full(), partial(), empty()
       , start_offset(0)         // possibly updated later
       , colours()               // set later
       , colour_next(0)
       , colour_alignment()      // set later
       , alloc_order()           // set later
       , requirements(requirements_)
+      , slot(NO_SLOT)           // set later
+      , aliases(NULL)
 {
+    claim_slot();
+
     /* Here, we figure out the parameters for individual slabs within this
        cache. Each slab has a Slab to manage it, which will either be allocated
        from the general memory pool, or stored in the same page(s) as the
@@ -332,27 +343,161 @@ Cache::Impl::Impl(
     Heap::heap->caches.enqueue(this);
 }
 Cache::Impl::~Impl() {
+    // every merged cache holds a reference, so their names are gone by now
+    assert(!aliases && "destroying a cache with merged caches");
+    // return any empty slabs
+    shrink();
     // remove this cache from the list it's in (which should be Heap::heap->caches)
     Heap::CacheList::remove(this);
+    if(slot == NO_SLOT)
+        return;
+    // return the other processors' empty slabs too, and reset every
+    // processor's share before handing the slot back; nobody may be
+    // releasing objects to a cache being destroyed, so anything else is left
+    // over from earlier and is leaked (processors that haven't been started
+    // share CPU 0's copy)
+    for(CPU::ID cpu = 0; cpu < CPU::MAX_CPUS; ++cpu)
+        if(Local *state = local(cpu)) {
+            shrink(*state);
+            state->~Local();
+            new (state) Local;
+        }
+    __atomic_fetch_and(&slots_used[slot / 64], ~(uint64_t(1) << (slot % 64)), __ATOMIC_RELEASE);
+}
+/**
+   Claims a free slot for this cache's per-processor state, which is empty
+   on every processor (see ~Impl()), or leaves #slot as #NO_SLOT if there are
+   none left.
+*/
+void Cache::Impl::claim_slot(void)
+{
+    for(size_t word = 0; word < sizeof(slots_used) / sizeof(slots_used[0]); ++word) {
+        uint64_t used = __atomic_load_n(&slots_used[word], __ATOMIC_RELAXED);
+        while(~used) {
+            unsigned bit = unsigned(__builtin_ctzll(~used));
+            if(word * 64 + bit >= MAX_SLOTS)
+                break;
+            if(__atomic_compare_exchange_n(
+                   &slots_used[word], &used, used | uint64_t(1) << bit,
+                   true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                slot = unsigned(word * 64 + bit);
+                return;
+            }
+        }
+    }
+}
+/**
+   Finds this cache's share of the processor we're running on, allocating
+   the page that holds it if this is the first time the processor has used
+   that page.
+
+   \returns the state, or NULL if this cache has no slot or there was no
+   memory for the page
+*/
+Cache::Local *Cache::Impl::local(void)
+{
+    if(slot == NO_SLOT)
+        return NULL;
+    Local *&chunk = *PerCPU::pointer(chunks[slot / SLOTS_PER_CHUNK]);
+    if(!chunk) {
+        char *page = Heap::allocate_page();
+        if(!page)
+            return NULL;
+        for(size_t i = 0; i < SLOTS_PER_CHUNK; ++i)
+            new (page + i * sizeof(Local)) Local;
+        chunk = reinterpret_cast<Local *>(page);
+    }
+    return &chunk[slot % SLOTS_PER_CHUNK];
+}
+/**
+   Finds this cache's share of another processor, without allocating it.
+
+   \param cpu the processor
+   \returns the state, or NULL if the processor hasn't used it
+*/
+Cache::Local *Cache::Impl::local(CPU::ID cpu)
+{
+    if(slot == NO_SLOT)
+        return NULL;
+    Local *chunk = *PerCPU::pointer(chunks[slot / SLOTS_PER_CHUNK], cpu);
+    return chunk ? &chunk[slot % SLOTS_PER_CHUNK] : NULL;
+}
+/**
+   Finds an existing mergeable cache that would lay out its slabs identically
+   to a new cache with the given parameters.
+
+   \returns the cache, or NULL if there is no compatible cache
+*/
+Cache::Impl *Cache::Impl::find_mergeable(
+    size_t size_, size_t alignment_, Flags flags_, Heap::Requirements requirements_
+    )
+{
+    if(!(flags_ & MERGEABLE))
+        return NULL;
+    size_ = round_up(size_, alignment_);
+    for(Heap::CacheList::iterator cache = Heap::heap->caches.begin(); cache != Heap::heap->caches.end(); ++cache) {
+        // OFF_SLAB is only a hint, so it doesn't prevent a merge
+        if( cache->flags & MERGEABLE
+            && cache->size == size_
+            && cache->alignment == alignment_
+            && (cache->flags & ~OFF_SLAB) == (flags_ & ~OFF_SLAB)
+            && cache->requirements == requirements_ )
+            return cache;
+    }
+    return NULL;
 }
 /**
-   Finds the best slab with free space, allocating it from the
-   system heap if necessary.
+   Records that a cache with a different name has been merged into this one.
 
+   \returns the record, to be passed to remove_alias() when the merged cache
+   is destroyed, or NULL if there was no memory for it
+*/
+Cache::Alias *Cache::Impl::add_alias(const char *name_)
+{
+    char *memory = Heap::allocate_bytes(sizeof(Alias));
+    if(!memory)
+        return NULL;
+    aliases = new (memory) Alias(aliases, name_);
+    return aliases;
+}
+//! forgets the name of a merged cache \param alias the record from add_alias()
+void Cache::Impl::remove_alias(Alias *alias)
+{
+    Alias **link = &aliases;
+    while(*link != alias) {
+        assert(*link && "removing an unknown cache alias");
+        link = &(*link)->next;
+    }
+    *link = alias->next;
+    Heap::free_bytes(reinterpret_cast<char *>(alias));
+}
+/**
+   Finds the best slab with free space among this processor's slabs,
+   allocating it from the system heap if necessary. Slabs owned by other
+   processors are never used, as only the owner may write a slab's
+   Slab::free_list.
+
+   \param state this processor's share of the cache
    \returns the slab, or NULL if a new one could not be allocated
 */
-Cache::Slab *Cache::Impl::get_allocatable_slab(void)
+Cache::Slab *Cache::Impl::get_allocatable_slab(Local &state)
 {
     // if there's a partial slab we can allocate from, return it
-    Slab *slab = partial.first();
+    Slab *slab = state.partial.first();
+    if(slab) return slab;
+
+    // otherwise, reclaim anything that other processors have released back
+    // to our slabs, and try again
+    drain_remote(state);
+    slab = state.partial.first();
     if(slab) return slab;
 
     // otherwise, if there's an empty slab we can allocate from, return that
-    slab = empty.first();
+    slab = state.empty.first();
     if(slab) {
         // move the empty slab into the partial list as we're about to allocate
         // from it.
-        partial.push(SlabList::remove(slab));
+        state.partial.push(SlabList::remove(slab));
         return slab;
     }
 
@@ -373,19 +518,24 @@ Cache::Slab *Cache::Impl::get_allocatable_slab(void)
 
     // drop our new empty slab straight into the partial list as we're about to
     // allocate from it.
-    partial.push(slab);
+    state.partial.push(slab);
 
-    // update all of the allocated Page%s to point to the slab, otherwise we
-    // can't convert an arbitrary pointer to an object within a slab back to
-    // the slab cache
-    for(int i = 0; i < (1<<alloc_order); ++i)
-        page[i].slab = slab;
+    // point the block's first Page at the slab, otherwise we can't convert an
+    // arbitrary pointer to an object within a slab back to the slab cache.
+    // The remaining Page%s are found from the first arithmetically by
+    // Heap::Impl::address_to_slab(), so don't need touching.
+    page->slab = slab;
 
     return slab;
 }
 char *Cache::Impl::allocate(void)
 {
-    Slab *slab = get_allocatable_slab();
+    // other processors need somewhere to send back objects from our slabs
+    Local *state = local();
+    if(!state)
+        return NULL;
+
+    Slab *slab = get_allocatable_slab(*state);
     // return failure if we couldn't find/allocate a suitable slab
     if(!slab)
         return NULL;
@@ -400,20 +550,45 @@ char *Cache::Impl::allocate(void)
     ++slab->active_count;
     // if the slab is full, move it to the full list
     if(slab->active_count == count) {
-        full.push(SlabList::remove(slab));
+        state->full.push(SlabList::remove(slab));
     }
 
     return slab->first_object + size * allocated;
 }
 void Cache::Impl::release(char *allocation)
+{
+    Slab *slab = Heap::heap->address_to_slab(allocation);
+    assert(slab && "Pointer not in a slab");
+
+    size_t allocated = (allocation - slab->first_object) / size;
+    assert(allocated < count && "Pointer off end of slab");
+
+    // objects belonging to another processor's slab are batched up and handed
+    // back to that processor
+    if(slab->owner != CPU::current()) {
+        release_remote(slab, allocated);
+        return;
+    }
+
+    // we allocated the slab, so our share of the cache exists
+    release_index(*local(CPU::current()), slab, allocated);
+}
+/**
+   Links an object back into its slab's free list, moving the slab between
+   the full/partial/empty lists as required. The slab must belong to this
+   processor.
+
+   \param state this processor's share of the cache
+   \param slab the slab containing the object
+   \param allocated the index of the object within the slab
+*/
+void Cache::Impl::release_index(Local &state, Slab *slab, size_t allocated)
 {
     /// \bug FIXME: check for double-free
-    Page *page = Heap::heap->address_to_page(allocation);
-    Slab *slab = page->slab;
 
     // if the slab was full, move it to the partial list
     if(slab->active_count == count) {
-        partial.push(SlabList::remove(slab));
+        state.partial.push(SlabList::remove(slab));
     }
 
     // we shouldn't have found an empty slab!
@@ -421,8 +596,6 @@ void Cache::Impl::release(char *allocation)
     assert(slab->active_count > 0 && slab->active_count <= count && "Double-free or corrupt slab");
 
     // re-link the object into the slab's free list
-    size_t allocated = (allocation - slab->first_object) / size;
-    assert(allocated < count && "Pointer off end of slab");
     assert(slab->free_list[allocated] == Slab::ALLOCATED && "Double-free");
     // if(slab->free_list[allocated] != Slab::ALLOCATED)
     //!\bug     throw DoubleFreeException();
@@ -432,36 +605,166 @@ void Cache::Impl::release(char *allocation)
 
     // if the slab became empty, move it to the empty list
     if(slab->active_count == 0) {
-        empty.push(SlabList::remove(slab));
+        state.empty.push(SlabList::remove(slab));
     }
 
 }
+/**
+   Releases an object belonging to a slab owned by another processor. The
+   object is added to this processor's RemoteBatch, which is flushed to the
+   slab when it fills up or when an object from a different slab is
+   released.
+
+   \bug the batch is per-processor state, so this needs interrupts disabled
+   once anything can call release() from an interrupt handler.
+
+   \param slab the slab containing the object
+   \param allocated the index of the object within the slab
+*/
+void Cache::Impl::release_remote(Slab *slab, size_t allocated)
+{
+    assert(slab->free_list[allocated] == Slab::ALLOCATED && "Double-free");
+    Local *state = local();
+    if(!state) {
+        // no memory for a batch, so send the object back on its own
+        RemoteBatch single;
+        single.slab = slab;
+        single.head = single.tail = Slab::ObjectIndex(allocated);
+        single.count = 1;
+        slab->free_list[allocated] = Slab::END_OF_LIST;
+        flush_remote(single);
+        return;
+    }
+    RemoteBatch &batch = state->batch;
+    if(batch.slab != slab || batch.count == RemoteBatch::MAX_COUNT) {
+        flush_remote(batch);
+        batch.slab = slab;
+        batch.head = Slab::END_OF_LIST;
+        batch.tail = Slab::ObjectIndex(allocated);
+    }
+    // nobody else will look at this entry until the batch is flushed, so
+    // it's safe to chain the batch through it
+    slab->free_list[allocated] = batch.head;
+    batch.head = Slab::ObjectIndex(allocated);
+    ++batch.count;
+}
+/**
+   Pushes a RemoteBatch onto its slab's Slab::remote_free stack in a single
+   atomic operation. If the stack was previously empty, the slab is also
+   pushed onto the owner's Cache::Local::pending stack for this cache, so
+   that the owner knows to drain it.
+
+   \param batch the batch to flush, which is left empty
+*/
+void Cache::Impl::flush_remote(RemoteBatch &batch)
+{
+    Slab *slab = batch.slab;
+    if(!slab)
+        return;
+
+    Slab::ObjectIndex old = __atomic_load_n(&slab->remote_free, __ATOMIC_RELAXED);
+    do {
+        slab->free_list[batch.tail] = old;
+    } while(!__atomic_compare_exchange_n(
+                &slab->remote_free, &old, batch.head,
+                true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+    if(old == Slab::END_OF_LIST) {
+        // the owner allocated the slab, so its state exists
+        Slab **pending = &local(slab->owner)->pending;
+        Slab *first = __atomic_load_n(pending, __ATOMIC_RELAXED);
+        do {
+            slab->remote_next = first;
+        } while(!__atomic_compare_exchange_n(
+                    pending, &first, slab,
+                    true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    }
+
+    batch.slab = NULL;
+    batch.count = 0;
+}
+/**
+   Flushes this processor's own RemoteBatch, so that it doesn't hold on to
+   another processor's objects indefinitely, then reclaims the objects that
+   other processors have released to this processor's slabs.
+
+   This is the single consumer of both Cache::Local::pending and Slab::remote_free,
+   so whole stacks can be taken with an atomic exchange and walked at leisure
+   without worrying about ABA. Slab::remote_next must be read before
+   Slab::remote_free is emptied, as the slab may be requeued immediately
+   afterwards.
+
+   \param state this processor's share of the cache
+*/
+void Cache::Impl::drain_remote(Local &state)
+{
+    flush_remote(state.batch);
+    Slab *slab = __atomic_exchange_n(&state.pending, static_cast<Slab *>(NULL), __ATOMIC_ACQUIRE);
+    while(slab) {
+        Slab *next_slab = slab->remote_next;
+        Slab::ObjectIndex allocated = __atomic_exchange_n(&slab->remote_free, Slab::END_OF_LIST, __ATOMIC_ACQUIRE);
+        while(allocated != Slab::END_OF_LIST) {
+            Slab::ObjectIndex next_allocated = slab->free_list[allocated];
+            slab->free_list[allocated] = Slab::ALLOCATED;
+            release_index(state, slab, allocated);
+            allocated = next_allocated;
+        }
+        slab = next_slab;
+    }
+}
+//! returns this processor's empty slabs to the heap \returns the number of slabs freed
 size_t Cache::Impl::shrink(void)
+{
+    Local *state = local(CPU::current());
+    if(!state)
+        return 0;
+    drain_remote(*state);
+    return shrink(*state);
+}
+/**
+   Returns the empty slabs from one processor's share of the cache to the
+   heap. Only the processor itself may call this, unless the cache is being
+   destroyed.
+
+   \param state the processor's share of the cache
+   \returns the number of slabs freed
+*/
+size_t Cache::Impl::shrink(Local &state)
 {
     size_t i = 0;
-    while(Slab *slab = empty.pop()) {
+    while(Slab *slab = state.empty.pop()) {
         ++i;
         assert(slab->active_count == 0); // slab should be empty
-        if(flags && OFF_SLAB)
-            Heap::heap->slab_cache.release(reinterpret_cast<char *>(slab));
+        // the objects may have been coloured past the first page of the
+        // block, so round down to find the block itself
         Heap::Block block = Heap::heap->address_to_block(slab->first_object, alloc_order);
+        block.pfn = round_down(block.pfn, Heap::PFN(1) << alloc_order);
+        Heap::heap->block_to_page(block)->slab = NULL;
+        if(flags & OFF_SLAB)
+            Heap::heap->slab_cache.release(reinterpret_cast<char *>(slab));
         Heap::Impl::free_block(block);
     }
     return i;
 }
 void Cache::Impl::dump(Formatter &formatter)
 {
-    if(!full.isempty()) {
-        formatter("    Full slabs:\n");
-        full.dump(formatter);
-    }
-    if(!partial.isempty()) {
-        formatter("    Partial slabs:\n");
-        partial.dump(formatter);
-    }
-    if(!empty.isempty()) {
-        formatter("    Empty slabs:\n");
-        empty.dump(formatter);
+    for(CPU::ID cpu = 0; cpu < CPU::count(); ++cpu) {
+        // processors that haven't been started share CPU 0's copy
+        Local *state = local(cpu);
+        if(!state || !CPU::is_online(cpu))
+            continue;
+        if(!state->full.isempty()) {
+            EXEC_FORMAT(formatter, "    CPU %u full slabs:\n", cpu);
+            state->full.dump(formatter);
+        }
+        if(!state->partial.isempty()) {
+            EXEC_FORMAT(formatter, "    CPU %u partial slabs:\n", cpu);
+            state->partial.dump(formatter);
+        }
+        if(!state->empty.isempty()) {
+            EXEC_FORMAT(formatter, "    CPU %u empty slabs:\n", cpu);
+            state->empty.dump(formatter);
+        }
     }
 }
 
@@ -474,16 +777,30 @@ void Cache::Impl::dump(Formatter &formatter)
     \param alignment_ minimum alignment of the objects
     \param flags_ cache flags
     \param requirements_ allocation requirements
+
+    If \p flags_ contains MERGEABLE and there is already a mergeable cache with
+    the same geometry, the new Cache refers to that instead.
 */
 Cache::Cache(
     const char *name_, int pri_, size_t size_, size_t alignment_, Flags flags_, Heap::Requirements requirements_
     )
-    : cache(new (Heap::heap->cache_cache.allocate()) Impl(name_, pri_, size_, alignment_, flags_, requirements_))
+    : cache(Impl::find_mergeable(size_, alignment_, flags_, requirements_))
+    , alias(NULL)
 {
+    if(cache) {
+        ++cache->refcount;
+        alias = cache->add_alias(name_);
+    } else {
+        cache = new (Heap::heap->cache_cache.allocate()) Impl(name_, pri_, size_, alignment_, flags_, requirements_);
+    }
 }
-/** \brief copy constructor */
+/** \brief copy constructor
+
+    The copy shares the original's Impl, but not its name if it was merged:
+    that goes when the original is destroyed. */
 Cache::Cache(const Cache &that)
     : cache(that.cache)
+    , alias(NULL)
 {
     ++cache->refcount;
 }
@@ -493,16 +810,20 @@ Cache &Cache::operator=(const Cache &that)
     if(this != &that) {
         this->~Cache();
         cache = that.cache;
+        alias = NULL;
         ++cache->refcount;
     }
-    ++cache->refcount;
     return *this;
 }
 /** \brief destructor */
 Cache::~Cache(void)
 {
-    if(!cache->refcount--)
+    if(alias)
+        cache->remove_alias(alias);
+    if(!--cache->refcount) {
+        cache->~Impl();
         Heap::heap->cache_cache.release(reinterpret_cast<char *>(cache));
+    }
 }
 char *Cache::allocate(void)
 {
@@ -516,6 +837,15 @@ size_t Cache::shrink(void)
 {
     return cache->shrink();
 }
+/** \brief forgets CPU 0's share of every cache on the
+    processor we're running on, so that it allocates its own
+
+    Per-processor variables start as copies of CPU 0's, so each processor
+    other than CPU 0 must call this before it uses any Cache. */
+void Cache::init_cpu(void)
+{
+    memset(PerCPU::pointer(Impl::chunks), 0, sizeof(Impl::chunks));
+}
 
 
 
@@ -533,6 +863,15 @@ void Heap::free_bytes(char *allocation)
 {
     Heap::Impl::free_bytes(allocation);
 }
+char *Heap::allocate_pages(Order order, Requirements requirements)
+{
+    Block block = Heap::Impl::allocate_block(order, requirements);
+    return block.is_sentinel() ? NULL : heap->block_to_address(block);
+}
+void Heap::free_pages(const char *pages, Order order)
+{
+    Heap::Impl::free_block(heap->address_to_block(const_cast<char *>(pages), order));
+}
 Heap::Block Heap::allocate_block(Order order, Requirements requirements)
 {
     return Heap::Impl::allocate_block(order, requirements);
@@ -548,7 +887,7 @@ void Heap::free_block(const Block &block)
 /* ====================================================================== */
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Winvalid-offsetof"
-Heap::Init::Init(
+EXEC_INIT Heap::Init::Init(
     char *begin, char *end,
     char *heap_begin, size_t zone_count
     )
@@ -580,30 +919,30 @@ Heap::Impl::Impl(char *start_, char *end_)
     , caches()
     , cache_cache("exec::Cache::Impl", Cache::SLAB, sizeof(Cache::Impl), CACHE_ALIGN)
     , slab_cache("exec::Cache::Slab", Cache::SLAB, sizeof(Cache::Slab), CACHE_ALIGN)
-    , heap32("heap-32B", Cache::HEAP, 32, 32)
-    , heap64("heap-64B", Cache::HEAP, 64, CACHE_ALIGN)
-    , heap128("heap-128B", Cache::HEAP, 128, CACHE_ALIGN)
-    , heap192("heap-192B", Cache::HEAP, 192, CACHE_ALIGN)
-    , heap256("heap-256B", Cache::HEAP, 256, CACHE_ALIGN)
-    , heap512("heap-512B", Cache::HEAP, 512, CACHE_ALIGN)
-    , heap1k("heap-1kiB", Cache::HEAP, 1<<10, CACHE_ALIGN)
-    , heap2k("heap-2kiB", Cache::HEAP, 2<<10, CACHE_ALIGN)
-    , heap4k("heap-4kiB", Cache::HEAP, 4<<10, CACHE_ALIGN)
-    , heap8k("heap-8kiB", Cache::HEAP, 8<<10, CACHE_ALIGN)
-    , heap16k("heap-16kiB", Cache::HEAP, 16<<10, CACHE_ALIGN)
-    , heap32k("heap-32kiB", Cache::HEAP, 32<<10, CACHE_ALIGN)
-    , heap64k("heap-64kiB", Cache::HEAP, 64<<10, CACHE_ALIGN)
-    , heap128k("heap-128kiB", Cache::HEAP, 128<<10, CACHE_ALIGN)
-    , heap256k("heap-256kiB", Cache::HEAP, 256<<10, CACHE_ALIGN)
-    , heap512k("heap-512kiB", Cache::HEAP, 512<<10, CACHE_ALIGN)
-    , heap1M("heap-1MiB", Cache::HEAP, 1<<20, CACHE_ALIGN)
-    , heap2M("heap-2MiB", Cache::HEAP, 2<<20, CACHE_ALIGN)
-    , heap4M("heap-4MiB", Cache::HEAP, 4<<20, CACHE_ALIGN)
+    , heap32("heap-32B", Cache::HEAP, 32, 32, Cache::MERGEABLE)
+    , heap64("heap-64B", Cache::HEAP, 64, CACHE_ALIGN, Cache::MERGEABLE)
+    , heap128("heap-128B", Cache::HEAP, 128, CACHE_ALIGN, Cache::MERGEABLE)
+    , heap192("heap-192B", Cache::HEAP, 192, CACHE_ALIGN, Cache::MERGEABLE)
+    , heap256("heap-256B", Cache::HEAP, 256, CACHE_ALIGN, Cache::MERGEABLE)
+    , heap512("heap-512B", Cache::HEAP, 512, CACHE_ALIGN, Cache::MERGEABLE)
+    , heap1k("heap-1kiB", Cache::HEAP, 1<<10, CACHE_ALIGN, Cache::MERGEABLE)
+    , heap2k("heap-2kiB", Cache::HEAP, 2<<10, CACHE_ALIGN, Cache::MERGEABLE)
+    , heap4k("heap-4kiB", Cache::HEAP, 4<<10, CACHE_ALIGN, Cache::MERGEABLE)
+    , heap8k("heap-8kiB", Cache::HEAP, 8<<10, CACHE_ALIGN, Cache::MERGEABLE)
+    , heap16k("heap-16kiB", Cache::HEAP, 16<<10, CACHE_ALIGN, Cache::MERGEABLE)
+    , heap32k("heap-32kiB", Cache::HEAP, 32<<10, CACHE_ALIGN, Cache::MERGEABLE)
+    , heap64k("heap-64kiB", Cache::HEAP, 64<<10, CACHE_ALIGN, Cache::MERGEABLE)
+    , heap128k("heap-128kiB", Cache::HEAP, 128<<10, CACHE_ALIGN, Cache::MERGEABLE)
+    , heap256k("heap-256kiB", Cache::HEAP, 256<<10, CACHE_ALIGN, Cache::MERGEABLE)
+    , heap512k("heap-512kiB", Cache::HEAP, 512<<10, CACHE_ALIGN, Cache::MERGEABLE)
+    , heap1M("heap-1MiB", Cache::HEAP, 1<<20, CACHE_ALIGN, Cache::MERGEABLE)
+    , heap2M("heap-2MiB", Cache::HEAP, 2<<20, CACHE_ALIGN, Cache::MERGEABLE)
+    , heap4M("heap-4MiB", Cache::HEAP, 4<<20, CACHE_ALIGN, Cache::MERGEABLE)
 {
 }
 
 // constructs the system-wide heap
-void Heap::Impl::create(const Heap::Init &init)
+EXEC_INIT void Heap::Impl::create(const Heap::Init &init)
 {
     // Heap::heap is initialised with its address *first* rather than being
     // assigned to the result of the placement new because the Impl constructor
@@ -671,15 +1010,49 @@ void Heap::Impl::free_block(const Block &block)
 }
 // \throws DoubleFreeException if memory was already free
 // \throws InvalidFreeException if memory is not in a Zone
+/**
+   Releases a range of pages to whichever zones it overlaps. The range may
+   span several zones, and any part of it not covered by a zone is ignored.
+*/
 void Heap::Impl::release_range(PFN pfn_begin, PFN pfn_end)
 {
     for(ZoneList::iterator zone = heap->zones.begin(); zone != heap->zones.end(); ++zone) {
-        if(zone->begin <= pfn_begin && pfn_end <= zone->end) {
-            zone->release_range(pfn_begin, pfn_end);
-            return;
-        }
+        PFN
+            begin = max(pfn_begin, zone->begin),
+            end = min(pfn_end, zone->end);
+        if(begin < end)
+            zone->release_range(begin, end);
     }
-    //! \bug throw UnmanagedFreeException();
+    //! \bug throw UnmanagedFreeException() for pages not in any zone
+}
+/**
+   Finds the slab containing an address.
+
+   Only the first Page of a slab's block points at the slab. Since buddy
+   blocks are naturally aligned, the first Page of any block of order \e n
+   containing the address is found by clearing the low \e n bits of the
+   address's PFN, so we try each order in turn until we find a Page that
+   heads a slab large enough to contain the address. This is at most
+   ORDER_COUNT reads of the Page[] rather than 2^n writes when a slab is
+   created, and the common case of an order-0 slab is found immediately.
+
+   \returns the slab, or NULL if the address is not in a slab
+*/
+Cache::Slab *Heap::Impl::address_to_slab(char *address)
+{
+    PFN pfn = (address - start) >> Heap::PAGE_SHIFT;
+    if(Cache::Slab *slab = pages[pfn].slab)
+        return slab;
+    for(Order order = 1; order < ORDER_COUNT; ++order) {
+        PFN head = round_down(pfn, PFN(1) << order);
+        if(head == pfn)
+            continue;           // same Page as last time
+        pfn = head;
+        Cache::Slab *slab = pages[head].slab;
+        if(slab && slab->cache->alloc_order >= order)
+            return slab;
+    }
+    return NULL;
 }
 char *Heap::Impl::allocate_bytes(size_t size)
 {
@@ -700,19 +1073,35 @@ char *Heap::Impl::allocate_bytes(size_t size)
     case ( 64<<10)+1 ... (128<<10): return Heap::heap->heap128k.allocate();
     case (128<<10)+1 ... (256<<10): return Heap::heap->heap256k.allocate();
     case (256<<10)+1 ... (512<<10): return Heap::heap->heap512k.allocate();
-    case (512<<10)+1 ... (  1<<20): return Heap::heap->heap1M.allocate();
-    case (  1<<20)+1 ... (  2<<20): return Heap::heap->heap2M.allocate();
-    case (  2<<20)+1 ... (  4<<20): return Heap::heap->heap4M.allocate();
+    case (512<<10)+1 ... (  1<<20): return large_allocation(Heap::heap->heap1M, size);
+    case (  1<<20)+1 ... (  2<<20): return large_allocation(Heap::heap->heap2M, size);
+    case (  2<<20)+1 ... (  4<<20): return large_allocation(Heap::heap->heap4M, size);
     default:
-        return NULL;
+        return VirtualHeap::allocate(size);
     }
 }
+/**
+   Allocates from one of the high-order caches, falling back to the
+   VirtualHeap if fragmentation means there is no suitable block for a new
+   slab.
+*/
+char *Heap::Impl::large_allocation(Cache::Impl &cache, size_t size)
+{
+    char *allocation = cache.allocate();
+    if(!allocation)
+        allocation = VirtualHeap::allocate(size);
+    return allocation;
+}
 void Heap::Impl::free_bytes(char *allocation)
 {
     // freeing NULL is permitted, and a no-op
     if(!allocation) return;
-    Page *page = Heap::heap->address_to_page(allocation);
-    Cache::Slab *slab = page->slab;
+    if(VirtualHeap::contains(allocation)) {
+        VirtualHeap::release(allocation);
+        return;
+    }
+    Cache::Slab *slab = Heap::heap->address_to_slab(allocation);
+    assert(slab && "Pointer not in a slab");
     Cache::Impl *cache = slab->cache;
     cache->release(allocation);
 }
@@ -720,19 +1109,19 @@ void Heap::Impl::dump(Formatter &formatter)
 {
     Heap::Impl *heap = Heap::heap;
     /// \bug obtain ro heap lock
-    formatter("Heap::Impl *heap at %p:\n", Heap::heap);
-    formatter("  Page[] at [%p, %p), %'zd bytes (sizeof(Page) = %'zd)\n", 
-              heap->pages, heap->pages + heap->page_count, heap->page_count * sizeof(Page), sizeof(Page)
+    EXEC_FORMAT(formatter, "Heap::Impl *heap at %p:\n", Heap::heap);
+    EXEC_FORMAT(formatter, "  Page[] at [%p, %p), %'zd bytes (sizeof(Page) = %'zd)\n", 
+              &heap->pages[0], &heap->pages[heap->page_count], heap->page_count * sizeof(Page), sizeof(Page)
         );
-    formatter("  Manages addresses [%p, %p) (%'zd pages, %'zd bytes)\n",
+    EXEC_FORMAT(formatter, "  Manages addresses [%p, %p) (%'zd pages, %'zd bytes)\n",
               heap->start,
               heap->start + (heap->page_count << PAGE_SHIFT),
               size_t(heap->page_count),
               size_t(heap->page_count) << PAGE_SHIFT
         );
     for(ZoneList::iterator zone = heap->zones.begin(); zone != heap->zones.end(); ++zone) {
-        formatter("  Heap::Zone \"%s\" at %p:\n", zone->name, zone);
-        formatter("    Manages addresses [%p, %p), PFNs [%'d, %'d), %'zd pages, %'zd bytes satisfying %x\n",
+        EXEC_FORMAT(formatter, "  Heap::Zone \"%s\" at %p:\n", zone->name, &*zone);
+        EXEC_FORMAT(formatter, "    Manages addresses [%p, %p), PFNs [%'zd, %'zd), %'zd pages, %'zd bytes satisfying %x\n",
                   heap->start + (zone->begin << PAGE_SHIFT),
                   heap->start + (zone->end << PAGE_SHIFT),
                   zone->begin, zone->end,
@@ -741,23 +1130,23 @@ void Heap::Impl::dump(Formatter &formatter)
                   zone->requirements
             );
 
-        formatter("    Buddy free:");
+        EXEC_FORMAT(formatter, "    Buddy free:");
         size_t free = 0;
         for(Order order = 0; order < ORDER_COUNT; ++order) {
             size_t count = 0;
             for(Zone::PageList::iterator page = zone->orders[order].begin(); page != zone->orders[order].end(); ++page) {
                 ++count;
             }
-            formatter(" %d<<%d", count, order);
+            EXEC_FORMAT(formatter, " %zd<<%zd", count, order);
             free += count << order;
         }
-        formatter(" = %'zd pages (%'zd bytes)\n", size_t(free), size_t(free) << PAGE_SHIFT);
+        EXEC_FORMAT(formatter, " = %'zd pages (%'zd bytes)\n", size_t(free), size_t(free) << PAGE_SHIFT);
     }
     /// \bug obtain ro cache lock
-    formatter("  Caches:\n");
-    formatter("pri\tref\tsize\talign\tflags\tcount\toffset\tcols\tcol_nxt\tcol_aln\torder\treq\tname\tcache*\n");
+    EXEC_FORMAT(formatter, "  Caches:\n");
+    EXEC_FORMAT(formatter, "pri\tref\tsize\talign\tflags\tcount\toffset\tcols\tcol_nxt\tcol_aln\torder\treq\tname\tcache*\n");
     for(CacheList::iterator cache = heap->caches.begin(); cache != heap->caches.end(); ++cache) {
-        formatter("%'d\t%'d\t%'d\t%'d\t%'d\t%'d\t%'d\t%'d\t%'d\t%'d\t%'d\t%'d\t%s\t%p\n",
+        EXEC_FORMAT(formatter, "%'d\t%'zd\t%'zd\t%'zd\t%'d\t%'zd\t%'zd\t%'zd\t%'zd\t%'zd\t%'zd\t%'d\t%s\t%p\n",
                   cache->priority,
                   cache->refcount,
                   cache->size,
@@ -771,8 +1160,14 @@ void Heap::Impl::dump(Formatter &formatter)
                   cache->alloc_order,
                   cache->requirements,
                   cache->name,
-                  cache
+                  &*cache
             );
+        if(cache->aliases) {
+            EXEC_FORMAT(formatter, "    Merged caches:");
+            for(Cache::Alias *alias = cache->aliases; alias; alias = alias->next)
+                EXEC_FORMAT(formatter, " %s", alias->name);
+            EXEC_FORMAT(formatter, "\n");
+        }
         cache->dump(formatter);
     }
 }
@@ -784,9 +1179,10 @@ void Heap::Impl::dump(Formatter &formatter)
 
 void Cache::SlabList::dump(Formatter &formatter) {
     for(iterator slab = begin(); slab != end(); ++slab) {
-        formatter(
-            "      cache=%p: first_object=%p, active_count=%d, first_free=%d\n",
-            slab->cache, slab->first_object, slab->active_count, slab->first_free
+        EXEC_FORMAT(formatter,
+            "      cache=%p: first_object=%p, owner=%d, active_count=%d, first_free=%d, remote_free=%d\n",
+            slab->cache, slab->first_object, slab->owner,
+            slab->active_count, slab->first_free, slab->remote_free
             );
         
     }
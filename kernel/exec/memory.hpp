@@ -70,16 +70,21 @@ struct exec::Heap::Block {
 
 /** \brief allocator of same-size objects */
 class exec::Cache {
+    class Alias;
     class Impl;
+    class Local;
+    class RemoteBatch;
     class Slab;
     class SlabList;
     Impl *cache;
+    Alias *alias;               //!< the name this Cache added to a merged #cache, or NULL
     friend class Page;
     friend class Heap;
 public:
     typedef unsigned Flags;
     enum FLAGS : Flags {
         OFF_SLAB = 1,           //!< Slab structure is off-slab
+        MERGEABLE = 2,          //!< may share slabs with a compatible cache
     };
     //! slab priorities
     enum PRIORITIES {
@@ -97,6 +102,8 @@ public:
     char *allocate(void);
     void release(char *);
     size_t shrink(void);
+
+    static void init_cpu(void);
 };
 
 /** \brief A descriptor for a memory page. \ingroup exec_memory
@@ -118,7 +125,7 @@ public:
 class exec::Page : public MinNode {
 #pragma GCC diagnostic pop
     friend class Cache;
-    Cache::Slab *slab;          //!< which slab manages this page (or NULL for unmanaged)
+    Cache::Slab *slab;          //!< which slab starts at this page (or NULL for unmanaged or not the first page)
     friend class Heap;
     /// \bug FIXME: #order is unsigned, which takes four/eight bytes when it only needs to be four bits
     Heap::Order order;         //!< records whether block is free and how large
@@ -7,11 +7,20 @@
 #ifndef EXEC_MEMORY_PRIV_HPP
 #define EXEC_MEMORY_PRIV_HPP
 
+#include "exec/cpu.hpp"
+
 /** \addtogroup exec_memory
     @{ */
 
 /** \brief slab descriptor (private)
 
+    Objects released by a processor other than the #owner are not linked
+    straight into #free_list, as that would mean bouncing the slab's cache
+    lines between processors. They are instead pushed onto #remote_free, a
+    lock-free stack threaded through #free_list, and the owner splices them
+    back into #free_list the next time it runs short of objects. See
+    Cache::Impl::release_remote().
+
 */
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Weffc++"
@@ -27,8 +36,11 @@ class exec::Cache::Slab : public exec::MinNode {
 
     Cache::Impl *cache;         //!< which cache this slab is part of
     char *first_object;         //!< address of first object in this slab
+    Slab *remote_next;          //!< next slab in its owner's Cache::Local::pending
+    CPU::ID owner;              //!< processor which allocated this slab
     ObjectIndex active_count;   //!< number of active objects in this slab
     ObjectIndex first_free; //!< pseudopointer to first free object in #free_list
+    ObjectIndex remote_free; //!< pseudopointer to objects released by other processors
     ObjectIndex free_list[0];   //!< array of pseudopointers to free objects
 
     Slab(void) = delete;                   //!< **deleted**
@@ -42,6 +54,29 @@ class exec::Cache::Slab : public exec::MinNode {
 };
 #pragma GCC diagnostic pop
 
+/** \brief batch of objects released to a slab owned by another processor (private)
+
+    The objects are chained through the slab's Slab::free_list, from #head to
+    #tail, so the whole batch can be pushed onto Slab::remote_free with a
+    single compare-and-swap.
+
+    All zeroes is an empty batch.
+*/
+class exec::Cache::RemoteBatch {
+    friend class Cache::Impl;
+    static const size_t MAX_COUNT = 16; //!< flush the batch at this size
+
+    Slab *slab;                 //!< slab the batch belongs to, or NULL if empty
+    Slab::ObjectIndex head;     //!< first object in the batch (if #slab isn't NULL)
+    Slab::ObjectIndex tail;     //!< last object in the batch (if #slab isn't NULL)
+    size_t count;               //!< number of objects in the batch
+
+    RemoteBatch(const RemoteBatch &) = delete;            //!< **deleted**
+    RemoteBatch &operator=(const RemoteBatch &) = delete; //!< **deleted**
+public:
+    RemoteBatch(void) = default;
+};
+
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Weffc++"
 class exec::Cache::SlabList : public exec::MinList<Cache::Slab> {
@@ -50,8 +85,65 @@ class exec::Cache::SlabList : public exec::MinList<Cache::Slab> {
 };
 #pragma GCC diagnostic pop
 
+/** \brief a processor's share of one cache (private)
+
+    Each Cache::Impl owns a slot in the per-processor Cache::Impl::chunks
+    of these. A processor only allocates from the slabs on its own lists,
+    which it is the Slab::owner of, so nobody else ever touches them or
+    the batches. #pending is written by other processors, but only when a
+    slab gains its first remotely-released objects.
+*/
+class exec::Cache::Local {
+    friend class Cache;
+    friend class Cache::Impl;
+
+    SlabList full;              //!< exec::MinList of this processor's full slabs
+    SlabList partial;           //!< exec::MinList of this processor's part-full slabs
+    SlabList empty;             //!< exec::MinList of this processor's empty slabs
+    /// lock-free stack of this processor's slabs with objects on Slab::remote_free
+    Slab *pending;
+    /// objects released by this processor to slabs owned by another processor
+    RemoteBatch batch;
+
+    Local(const Local &) = delete;            //!< **deleted**
+    Local &operator=(const Local &) = delete; //!< **deleted**
+public:
+    Local(void) : full(), partial(), empty(), pending(NULL), batch() {}
+};
+
+/** \brief the name of a cache merged into another Cache::Impl (private)
+
+    Only Heap::dump() looks at these, so they're kept in a singly-linked
+    list rather than a MinList, to keep Cache::Impl small.
+*/
+class exec::Cache::Alias {
+    friend class Cache;
+    friend class Cache::Impl;
+    friend class Heap::Impl;
+
+    Alias *next;                //!< next name merged into the same cache
+    const char *name;           //!< the merged cache's name
+
+    Alias(void) = delete;                    //!< **deleted**
+    Alias(const Alias &) = delete;           //!< **deleted**
+    Alias &operator=(const Alias &) = delete; //!< **deleted**
+    Alias(Alias *next_, const char *name_) : next(next_), name(name_) {}
+};
+
 /** \brief implementation of exec::Cache (private)
 
+    Caches created with Cache::MERGEABLE share a single Cache::Impl with any
+    existing mergeable cache of the same geometry, rather than each keeping
+    their own half-empty slabs. The names of the later caches are kept in
+    #aliases so that Heap::dump() can still report them.
+
+    Each cache claims one of the #MAX_SLOTS slots for its per-processor
+    slabs and remote-free state (see Cache::Local), so that Cache::Impl
+    doesn't grow with the number of processors. A processor's Local%s are kept in pages of #SLOTS_PER_CHUNK,
+    listed in its copy of #chunks, and each page is allocated the first time
+    the processor uses one of its slots. A cache that can't claim a slot
+    fails every allocation.
+
     \bug the different kinds of alignment are a bit muddled and need a good debug.
 
 */
@@ -62,14 +154,11 @@ class exec::Cache::Impl : public exec::Node {
     friend class Heap::Impl;
     friend class Slab;
 
+    Flags flags;                //!< slab flags (first, to fill Node's tail padding)
     size_t refcount;            //!< number of references to this cache
     size_t size;                //!< object size
     size_t alignment;           //!< object alignment
-    Flags flags;                //!< slab flags
     size_t count;               //!< number of objects per slab
-    SlabList full;              //!< exec::MinList of full slabs
-    SlabList partial;           //!< exec::MinList of part-full slabs
-    SlabList empty;             //!< exec::MinList of empty slabs
     /// \bug FIXME: needs a (spin)lock
     size_t start_offset;        //!< offset into slab where we allocate objects (used to skip inline Slab)
     size_t colours;             //!< number of colours
@@ -78,6 +167,16 @@ class exec::Cache::Impl : public exec::Node {
 
     Heap::Order alloc_order;     //!< allocation order for new slabs
     Heap::Requirements requirements; //!< allocation flags for new slabs
+    unsigned slot;              //!< this cache's slot in #chunks, or #NO_SLOT
+
+    static const unsigned NO_SLOT = ~0U; //!< the slots had run out
+    static const size_t SLOTS_PER_CHUNK = Heap::PAGE_SIZE / sizeof(Local); //!< Local%s per page
+    static const size_t MAX_CHUNKS = 64; //!< number of entries in #chunks
+    static const size_t MAX_SLOTS = SLOTS_PER_CHUNK * MAX_CHUNKS; //!< most caches there can be
+    static Local *chunks[MAX_CHUNKS]; //!< (per-processor) pages of Local%s, or NULL
+    static uint64_t slots_used[(MAX_SLOTS + 63) / 64]; //!< bitmap of the slots in use
+
+    Alias *aliases;             //!< names of caches merged into this one, newest first
 
     /// \bug FIXME: Linux optionally collects statistics
 
@@ -85,15 +184,27 @@ class exec::Cache::Impl : public exec::Node {
     Impl(const Impl &) = delete;           //!< **deleted**
     Impl operator=(const Impl &) = delete; //!< **deleted**
 
-    Slab *get_allocatable_slab(void);
+    Slab *get_allocatable_slab(Local &);
     Impl(
         const char *, int,
         size_t, size_t, Cache::Flags=0, Heap::Requirements=0
         );
     ~Impl();
 
+    static Impl *find_mergeable(size_t, size_t, Cache::Flags, Heap::Requirements);
+    Alias *add_alias(const char *);
+    void remove_alias(Alias *);
+
     char *allocate(void);
     void release(char *);
+    void release_index(Local &, Slab *, size_t);
+    void claim_slot(void);
+    Local *local(void);
+    Local *local(CPU::ID);
+    void release_remote(Slab *, size_t);
+    void flush_remote(RemoteBatch &);
+    void drain_remote(Local &);
+    size_t shrink(Local &);
     size_t shrink(void);
     void dump(exec::Formatter &);
 };
@@ -144,11 +255,13 @@ class exec::Heap::Impl {
     static Block allocate_block(Heap::Order, Heap::Requirements);
     static void free_block(const Block &);
     static char *allocate_bytes(size_t size) __attribute__((malloc));
+    static char *large_allocation(Cache::Impl &, size_t);
     static void free_bytes(char *) __attribute__((nonnull));
     Block address_to_block(char *address, Heap::Order order)
     { return Block((address - start) >> Heap::PAGE_SHIFT, order); }
     Page *address_to_page(char *address)
     { return pages + ((address - start) >> Heap::PAGE_SHIFT); }
+    Cache::Slab *address_to_slab(char *address);
     char *block_to_address(const Block &block)
     { return start + (block.pfn << Heap::PAGE_SHIFT); }
     Page *block_to_page(const Block &block)
@@ -221,6 +334,8 @@ class exec::Heap::Init {
     Init(char *, char *, char *, size_t);
     char *next_zone(void) { char *zone = zones; zones += sizeof(Zone); return zone; }
     PFN pfn(char *ptr) { return (ptr - ram_begin) >> Heap::PAGE_SHIFT; }
+    //! \returns the number of bytes needed for the Heap::Impl, its Page[] array and the Zones
+    size_t bytes(void) const { return size_t(alloc_end - heap_impl); }
 };
 
 /** @} */
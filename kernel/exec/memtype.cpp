@@ -0,0 +1,313 @@
+// -*- mode: c++ -*-
+/**
+   \brief Memory types, PAT and MTRRs (implementation)
+   \file
+*/
+
+#include <stddef.h>
+
+#include "exec/format.hpp"
+#include "exec/memtype.hpp"
+#include "exec/util.hpp"
+#include "exec/x86.hpp"
+
+using namespace exec;
+
+/** \defgroup exec_memtype MemoryType: caching of physical memory
+
+    The processor decides how to cache each access by combining two memory
+    types: one from the MTRRs, which the firmware programs to describe
+    physical memory, and one from the Page Attribute Table (PAT), which is
+    selected by the PWT, PCD and PAT bits of the page table entry. Broadly,
+    the more restrictive of the two wins, except that a WC page overrides an
+    MTRR type of UC so that frame buffers can be write-combined.
+
+    We therefore map RAM as WB, frame buffers as WC and anything else as UC,
+    and use the MTRRs to check what the firmware thinks the memory is: if an
+    MTRR says something is not WB, we map it with the same type, and if a page
+    would straddle ranges of different types we map it UC (the processor's
+    behaviour is undefined otherwise).
+
+    The PAT is programmed as follows. The first four entries match the
+    power-on defaults, except that entry 1 is WC rather than WT, so that WC
+    can be selected in both small and large pages without the PAT bit (whose
+    position differs between them).
+
+    | Index | PAT | PCD | PWT | Type |
+    |-------|-----|-----|-----|------|
+    | 0     | 0   | 0   | 0   | WB   |
+    | 1     | 0   | 0   | 1   | WC   |
+    | 2     | 0   | 1   | 0   | UC-  |
+    | 3     | 0   | 1   | 1   | UC   |
+    | 4     | 1   | 0   | 0   | WB   |
+    | 5     | 1   | 0   | 1   | WP   |
+    | 6     | 1   | 1   | 0   | UC-  |
+    | 7     | 1   | 1   | 1   | WT   |
+
+    The PAT must be programmed identically on every processor, and must be
+    programmed before any mapping using it is created, so init() is called
+    before paging is enabled.
+
+    @{
+*/
+
+bool MemoryType::pat = false;
+bool MemoryType::mtrr_enabled = false;
+bool MemoryType::fixed_enabled = false;
+MemoryType::Type MemoryType::default_type = MemoryType::WB;
+size_t MemoryType::variable_count = 0;
+bool MemoryType::variable_overflow = false;
+uint64_t MemoryType::fixed[MemoryType::FIXED_COUNT];
+MemoryType::Variable MemoryType::variable[MemoryType::MAX_VARIABLE];
+
+/** @} */
+
+namespace {
+    const uint32_t MSR_MTRRCAP = 0xfe;
+    const uint32_t MSR_MTRR_PHYSBASE0 = 0x200; //!< PHYSMASKn follows each PHYSBASEn
+    const uint32_t MSR_MTRR_FIX64K_00000 = 0x250;
+    const uint32_t MSR_MTRR_FIX16K_80000 = 0x258;
+    const uint32_t MSR_MTRR_FIX4K_C0000 = 0x268;
+    const uint32_t MSR_PAT = 0x277;
+    const uint32_t MSR_MTRR_DEF_TYPE = 0x2ff;
+
+    const uint32_t CPUID_EDX_MTRR = 1 << 12;
+    const uint32_t CPUID_EDX_PAT = 1 << 16;
+
+    const uint64_t MTRR_VALID = 1 << 11;         //!< in PHYSMASKn and MTRR_DEF_TYPE
+    const uint64_t MTRR_FIXED_ENABLE = 1 << 10;  //!< in MTRR_DEF_TYPE
+    const uint64_t MTRRCAP_FIXED = 1 << 8;
+
+    const uint64_t PTE_PWT = 1 << 3;
+    const uint64_t PTE_PCD = 1 << 4;
+    const uint64_t PTE_PAT = 1 << 7;        //!< in a 4KiB page table entry
+    const uint64_t PTE_PAT_LARGE = 1 << 12; //!< in a 2MiB or 1GiB page entry
+
+    //! the PAT layout we program, indexed by PAT:PCD:PWT
+    const MemoryType::Type PAT_LAYOUT[8] = {
+        MemoryType::WB, MemoryType::WC, MemoryType::UC_MINUS, MemoryType::UC,
+        MemoryType::WB, MemoryType::WP, MemoryType::UC_MINUS, MemoryType::WT
+    };
+    //! the PAT layout at power-on, or without a PAT
+    const MemoryType::Type POWER_ON_LAYOUT[4] = {
+        MemoryType::WB, MemoryType::WT, MemoryType::UC_MINUS, MemoryType::UC
+    };
+
+    uint64_t pat_msr_value(void)
+    {
+        uint64_t value = 0;
+        for(unsigned i = 0; i < 8; ++i)
+            value |= uint64_t(PAT_LAYOUT[i]) << (i * 8);
+        return value;
+    }
+
+    //! \returns the number of physical address bits
+    unsigned physical_address_bits(void)
+    {
+        uint32_t regs[4];
+        cpuid(0x80000000, 0, regs);
+        if(regs[0] < 0x80000008)
+            return 36;
+        cpuid(0x80000008, 0, regs);
+        return regs[0] & 0xff;
+    }
+}
+
+
+
+/* ====================================================================== */
+/** \brief programs the PAT and reads the MTRRs
+
+    This needs to be called on the first processor before it enables paging.
+    The MTRRs are the same on every processor, so the others only need
+    init_cpu().
+*/
+void MemoryType::init(void)
+{
+    init_cpu();
+    uint32_t regs[4];
+    cpuid(1, 0, regs);
+    uint32_t features = regs[3];
+
+    if(!(features & CPUID_EDX_MTRR))
+        return;
+    mtrr_enabled = true;
+    uint64_t
+        capabilities = msr(MSR_MTRRCAP),
+        def_type = msr(MSR_MTRR_DEF_TYPE);
+    if(!(def_type & MTRR_VALID)) {
+        // MTRRs are present but disabled, which makes everything UC
+        default_type = UC;
+        fixed_enabled = false;
+        variable_count = 0;
+        return;
+    }
+    default_type = Type(def_type & 0xff);
+
+    fixed_enabled = (capabilities & MTRRCAP_FIXED) && (def_type & MTRR_FIXED_ENABLE);
+    if(fixed_enabled) {
+        fixed[0] = msr(MSR_MTRR_FIX64K_00000);
+        fixed[1] = msr(MSR_MTRR_FIX16K_80000);
+        fixed[2] = msr(MSR_MTRR_FIX16K_80000 + 1);
+        for(unsigned i = 0; i < 8; ++i)
+            fixed[3 + i] = msr(MSR_MTRR_FIX4K_C0000 + i);
+    }
+
+    uint64_t physical_mask = (uint64_t(1) << physical_address_bits()) - 1;
+    variable_count = 0;
+    for(uint32_t i = 0; i < (capabilities & 0xff); ++i) {
+        uint64_t
+            base = msr(MSR_MTRR_PHYSBASE0 + 2 * i),
+            mask = msr(MSR_MTRR_PHYSBASE0 + 2 * i + 1);
+        if(!(mask & MTRR_VALID))
+            continue;
+        if(variable_count == MAX_VARIABLE) {
+            // we can't tell what the rest cover, see variable_type()
+            variable_overflow = true;
+            break;
+        }
+        /// \bug assumes the mask is contiguous, which it is in practice
+        Variable &range = variable[variable_count++];
+        range.begin = base & physical_mask & ~uint64_t(0xfff);
+        range.end = range.begin + ((~mask & physical_mask) | 0xfff) + 1;
+        range.type = Type(base & 0xff);
+    }
+}
+/** \brief programs the PAT of the processor we're running on
+
+    init() does this for the first processor; the others must call this
+    before they use any mapping that isn't WB.
+*/
+void MemoryType::init_cpu(void)
+{
+    uint32_t regs[4];
+    cpuid(1, 0, regs);
+    if(regs[3] & CPUID_EDX_PAT) {
+        uint64_t value = pat_msr_value();
+        if(msr(MSR_PAT) != value)
+            msr(MSR_PAT, value);
+        pat = true;
+    }
+}
+/** \brief gets the page table entry bits for a memory type
+    \param type the memory type
+    \param large whether the entry maps a 2MiB or 1GiB page, which moves the PAT bit
+    \returns the PWT, PCD and PAT bits selecting the type (falling back to
+    UC- if the type isn't available without a PAT) */
+uint64_t MemoryType::pte_flags(Type type, bool large)
+{
+    const Type *layout = pat ? PAT_LAYOUT : POWER_ON_LAYOUT;
+    unsigned count = pat ? 8 : 4, index = 2;
+    for(unsigned i = 0; i < count; ++i) {
+        if(layout[i] == type) {
+            index = i;
+            break;
+        }
+    }
+    return
+        (index & 1 ? PTE_PWT : 0) |
+        (index & 2 ? PTE_PCD : 0) |
+        (index & 4 ? (large ? PTE_PAT_LARGE : PTE_PAT) : 0);
+}
+/** \brief finds the fixed-range MTRR type of an address
+    \param address the address, which must be below 1MiB */
+MemoryType::Type MemoryType::fixed_type(uint64_t address)
+{
+    size_t index, field;
+    if(address < 0x80000) {             // 8 x 64KiB
+        index = 0;
+        field = size_t(address >> 16);
+    } else if(address < 0xc0000) {      // 16 x 16KiB
+        index = 1 + size_t((address - 0x80000) >> 17);
+        field = size_t((address - 0x80000) >> 14) & 7;
+    } else {                            // 64 x 4KiB
+        index = 3 + size_t((address - 0xc0000) >> 15);
+        field = size_t((address - 0xc0000) >> 12) & 7;
+    }
+    return Type((fixed[index] >> (field * 8)) & 0xff);
+}
+/** \brief finds the variable-range MTRR type of a range of addresses
+    \returns the type, or MIXED if the range is only partly covered by an MTRR
+    or there were variable MTRRs that we couldn't track, as any address could
+    be covered by one of those */
+MemoryType::Type MemoryType::variable_type(uint64_t begin, uint64_t end)
+{
+    if(variable_overflow)
+        return MIXED;
+    Type type = MIXED;
+    for(size_t i = 0; i < variable_count; ++i) {
+        const Variable &range = variable[i];
+        if(range.end <= begin || range.begin >= end)
+            continue;
+        if(range.begin > begin || range.end < end)
+            return MIXED;
+        if(type == MIXED || type == range.type) {
+            type = range.type;
+        } else if(
+            (type == WT && range.type == WB) ||
+            (type == WB && range.type == WT)
+            ) {
+            type = WT;          // WT wins over WB where they overlap
+        } else {
+            type = UC;          // UC wins, and any other overlap is undefined
+        }
+    }
+    return type == MIXED ? default_type : type;
+}
+/** \brief finds the MTRR memory type of a range of physical addresses
+    \param begin the start of the range
+    \param end one-past-end of the range
+    \returns the type, or MIXED if the range is covered by more than one type.
+    WB is returned if there are no MTRRs, as they then impose no restriction. */
+MemoryType::Type MemoryType::mtrr(uint64_t begin, uint64_t end)
+{
+    static const uint64_t one_meg = 1 << 20;
+    if(!mtrr_enabled)
+        return WB;
+
+    Type type = MIXED;
+    if(fixed_enabled && begin < one_meg) {
+        for(uint64_t address = round_down(begin, uint64_t(4096)); address < min(end, one_meg); address += 4096) {
+            Type t = fixed_type(address);
+            if(type != MIXED && t != type)
+                return MIXED;
+            type = t;
+        }
+        if(end <= one_meg)
+            return type;
+        begin = one_meg;
+    }
+
+    Type t = variable_type(begin, end);
+    return type == MIXED || type == t ? t : MIXED;
+}
+//! \returns the conventional abbreviation for a memory type
+const char *MemoryType::name(Type type)
+{
+    switch(type) {
+    case UC: return "UC";
+    case WC: return "WC";
+    case WT: return "WT";
+    case WP: return "WP";
+    case WB: return "WB";
+    case UC_MINUS: return "UC-";
+    case MIXED: return "mixed";
+    }
+    return "invalid";
+}
+void MemoryType::dump(Formatter &formatter)
+{
+    EXEC_FORMAT(formatter, "PAT: %s\n", pat ? "programmed" : "not supported");
+    if(!mtrr_enabled) {
+        EXEC_FORMAT(formatter, "MTRRs: not supported\n");
+        return;
+    }
+    EXEC_FORMAT(formatter, "MTRRs: default %s, fixed ranges %s\n",
+              name(default_type), fixed_enabled ? "enabled" : "disabled");
+    for(size_t i = 0; i < variable_count; ++i)
+        EXEC_FORMAT(formatter, "  [%#'llx, %#'llx) %s\n",
+                  variable[i].begin, variable[i].end, name(variable[i].type));
+    if(variable_overflow)
+        EXEC_FORMAT(formatter, "  (more than %zd variable ranges, so treating everything above 1MiB as mixed)\n",
+                  size_t(MAX_VARIABLE));
+}
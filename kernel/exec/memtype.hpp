@@ -0,0 +1,68 @@
+// -*- mode: c++ -*-
+/**
+   \brief Memory types, PAT and MTRRs (headers)
+   \file
+*/
+
+#ifndef EXEC_MEMTYPE_HPP
+#define EXEC_MEMTYPE_HPP
+
+/** \addtogroup exec_memtype
+    @{ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "exec/types.hpp"
+
+/** \brief processor memory (caching) types
+
+    \note This is used by both the 32 bit bootloader and the 64 bit kernel, so
+    addresses are always 64 bit physical addresses rather than pointers.
+*/
+class exec::MemoryType {
+public:
+    /** \brief a memory type, using the architectural encoding shared by the
+        PAT and MTRRs */
+    enum Type : uint8_t {
+        UC = 0,                 //!< uncacheable
+        WC = 1,                 //!< write-combining
+        WT = 4,                 //!< write-through
+        WP = 5,                 //!< write-protected
+        WB = 6,                 //!< write-back
+        UC_MINUS = 7,           //!< uncacheable, but overridable by WC MTRRs (PAT only)
+        MIXED = 0xff            //!< (not a type) a range is covered by more than one type
+    };
+private:
+    static const size_t MAX_VARIABLE = 16; //!< most variable MTRRs we track
+    static const size_t FIXED_COUNT = 11;  //!< number of fixed-range MTRR MSRs
+
+    static bool pat;            //!< whether the PAT has been programmed
+    static bool mtrr_enabled;   //!< whether the MTRRs are present and enabled
+    static bool fixed_enabled;  //!< whether the fixed-range MTRRs are enabled
+    static Type default_type;   //!< type of memory not covered by an MTRR
+    static size_t variable_count; //!< number of valid entries in #variable
+    static bool variable_overflow; //!< whether there were more than #MAX_VARIABLE enabled
+    //! a variable-range MTRR, as a half-open range of physical addresses
+    struct Variable {
+        uint64_t begin;         //!< first address covered
+        uint64_t end;           //!< one-past-last address covered
+        Type type;              //!< the memory type
+    };
+    static uint64_t fixed[FIXED_COUNT]; //!< fixed-range MTRR contents
+    static Variable variable[MAX_VARIABLE]; //!< enabled variable-range MTRRs
+
+    static Type fixed_type(uint64_t);
+    static Type variable_type(uint64_t, uint64_t);
+public:
+    static void init(void);
+    static void init_cpu(void);
+    static uint64_t pte_flags(Type, bool);
+    static Type mtrr(uint64_t, uint64_t);
+    static const char *name(Type);
+    static void dump(Formatter &);
+};
+
+/** @} */
+
+#endif
@@ -4,11 +4,34 @@ BOOTSRC += \
 	kernel/exec/boot.cpp \
 	kernel/exec/boot_entry.S \
 	kernel/exec/format.cpp \
-	kernel/exec/memory.cpp \
+	kernel/exec/memblock.cpp \
+	kernel/exec/memtype.cpp \
+	kernel/exec/serial.cpp \
+	kernel/exec/string.cpp \
 
 SRC += \
+	kernel/exec/acpi.cpp \
+	kernel/exec/apic.cpp \
+	kernel/exec/aspace.cpp \
+	kernel/exec/bootprof.cpp \
+	kernel/exec/bufserial.cpp \
+	kernel/exec/cpu.cpp \
 	kernel/exec/format.cpp \
+	kernel/exec/fpu.cpp \
+	kernel/exec/interrupt.cpp \
+	kernel/exec/interrupt_entry.S \
+	kernel/exec/ioapic.cpp \
 	kernel/exec/kernel.cpp \
 	kernel/exec/kernel_entry.S \
+	kernel/exec/log.cpp \
+	kernel/exec/memblock.cpp \
 	kernel/exec/memory.cpp \
+	kernel/exec/memtype.cpp \
+	kernel/exec/pagetable.cpp \
+	kernel/exec/percpu.cpp \
+	kernel/exec/serial.cpp \
+	kernel/exec/string.cpp \
 	kernel/exec/task.cpp \
+	kernel/exec/trampoline.S \
+	kernel/exec/tsc.cpp \
+	kernel/exec/vheap.cpp \
@@ -0,0 +1,297 @@
+// -*- mode: c++ -*-
+/**
+   \brief Page tables (implementation)
+   \file
+*/
+
+#include <assert.h>
+#include <stddef.h>
+
+#include "exec/init.hpp"
+#include "exec/memory.hpp"
+#include "exec/pagetable.hpp"
+#include "exec/string.hpp"
+#include "exec/util.hpp"
+#include "exec/x86.hpp"
+
+using namespace exec;
+
+/** \defgroup exec_pagetable PageTable: mapping virtual memory
+
+    A PageTable manipulates a four-level page table hierarchy through the
+    direct map of physical memory. Mappings are made with the largest pages
+    (4KiB, 2MiB or, where the processor supports them, 1GiB) allowed by the
+    alignment and length of the range. Large pages are split when only part
+    of one is changed, and page tables are allocated from the Heap as needed.
+
+    Every change records the TLB invalidation it needs in an
+    AddressSpace::Flush rather than making it immediately, so that an
+    operation on a range of pages costs at most one flush.
+
+    Mappings in the upper (kernel) half are global, and table entries in the
+    lower half allow user access so that the leaf entries alone control it.
+
+    \bug page tables are never freed, even when they become empty.
+
+    @{
+*/
+
+bool PageTable::gigabyte_pages = false;
+
+/** @} */
+
+namespace {
+    const PageTable::Entry PAT_SMALL = 1 << 7;  //!< PAT bit in a 4KiB page entry
+    const PageTable::Entry PAT_LARGE = 1 << 12; //!< PAT bit in a 2MiB or 1GiB page entry
+
+    //! \returns the index into the table at a level
+    size_t index(const char *address, unsigned shift)
+    {
+        return (reinterpret_cast<uintptr_t>(address) >> shift) & 511;
+    }
+}
+
+
+
+/* ====================================================================== */
+//! finds out which page sizes the processor supports
+EXEC_INIT void PageTable::init(void)
+{
+    uint32_t regs[4];
+    cpuid(0x80000000, 0, regs);
+    if(regs[0] >= 0x80000001) {
+        cpuid(0x80000001, 0, regs);
+        gigabyte_pages = regs[3] & (1 << 26);
+    }
+}
+/** \brief makes an entry pointing at a table
+    \param address an address the table will map
+    \param page the (direct-mapped) table
+    \returns the entry, with permissions that leave the leaves in control */
+PageTable::Entry PageTable::table_entry(const char *address, char *page)
+{
+    return phys(page) | PRESENT | WRITABLE | (is_kernel(address) ? 0 : USER);
+}
+/** \brief replaces a large page with a table of smaller pages mapping the
+    same memory with the same attributes
+    \param address an address within the page
+    \param entry the large page's entry
+    \param shift log2 of the size of the large page
+    \param flush receives the invalidation of the large page
+    \returns true on success, or false if the table couldn't be allocated */
+bool PageTable::split(const char *address, Entry &entry, unsigned shift, AddressSpace::Flush &flush)
+{
+    char *page = Heap::allocate_page();
+    if(!page)
+        return false;
+    Entry *children = reinterpret_cast<Entry *>(page);
+    unsigned child_shift = shift - 9;
+    Entry
+        base = entry & ADDRESS & ~((Entry(1) << shift) - 1),
+        flags = entry & ~ADDRESS,
+        pat = entry & PAT_LARGE;
+    if(child_shift == SHIFT_4K)
+        flags = (flags & ~LARGE) | (pat ? PAT_SMALL : 0); // same bit
+    else
+        flags |= pat;
+    for(size_t i = 0; i < 512; ++i)
+        children[i] = (base + (Entry(i) << child_shift)) | flags;
+    entry = table_entry(address, page);
+    flush.add(address);
+    return true;
+}
+/** \brief finds the entry at a level for an address, allocating tables and
+    splitting large pages on the way as necessary
+    \param address the address
+    \param shift log2 of the size of memory mapped by entries at the level
+    \param flush receives the invalidations of any large pages split
+    \returns the entry, or NULL if a table couldn't be allocated */
+PageTable::Entry *PageTable::walk(const char *address, unsigned shift, AddressSpace::Flush &flush)
+{
+    Entry *t = reinterpret_cast<Entry *>(virt(root));
+    for(unsigned level = 39; ; level -= 9) {
+        Entry &entry = t[index(address, level)];
+        if(level == shift)
+            return &entry;
+        if(!(entry & PRESENT)) {
+            char *page = Heap::allocate_page();
+            if(!page)
+                return NULL;
+            String::clear_page(page);
+            entry = table_entry(address, page);
+        } else if(entry & LARGE) {
+            if(!split(address, entry, level, flush))
+                return NULL;
+        }
+        t = table(entry);
+    }
+}
+/** \brief finds the entry that maps an address
+    \param address the address
+    \param shift receives log2 of the size of memory covered by the entry
+    \returns the leaf entry, or the non-present entry that ended the walk */
+PageTable::Entry *PageTable::lookup(const char *address, unsigned &shift) const
+{
+    Entry *t = reinterpret_cast<Entry *>(virt(root));
+    for(unsigned level = 39; ; level -= 9) {
+        Entry &entry = t[index(address, level)];
+        if(level == SHIFT_4K || !(entry & PRESENT) || (entry & LARGE)) {
+            shift = level;
+            return &entry;
+        }
+        t = table(entry);
+    }
+}
+/** \brief maps a range of physical memory
+    \param address the page-aligned virtual address to map at
+    \param physical the page-aligned physical address to map
+    \param length the length of the range, a multiple of the page size
+    \param flags #WRITABLE and/or #USER
+    \param type the memory type
+    \param flush receives the invalidations of any mappings replaced
+    \returns true on success, or false if a table couldn't be allocated (in
+    which case part of the range may be mapped) */
+bool PageTable::map(char *address, Physical physical, size_t length, Entry flags, MemoryType::Type type, AddressSpace::Flush &flush)
+{
+    assert(!(reinterpret_cast<uintptr_t>(address) & (Heap::PAGE_SIZE - 1)) && "unaligned address");
+    assert(!(physical & (Heap::PAGE_SIZE - 1)) && "unaligned physical address");
+    assert(!(length & (Heap::PAGE_SIZE - 1)) && "unaligned length");
+    if(is_kernel(address))
+        flags |= GLOBAL;
+    while(length) {
+        // use the largest page that fits, unless there's already a table there
+        Entry *entry;
+        unsigned shift = gigabyte_pages ? SHIFT_1G : SHIFT_2M;
+        for(;; shift -= 9) {
+            Entry size = Entry(1) << shift;
+            if(
+                shift == SHIFT_4K
+                || (!((reinterpret_cast<uintptr_t>(address) | physical) & (size - 1)) && length >= size)
+                ) {
+                entry = walk(address, shift, flush);
+                if(!entry)
+                    return false;
+                if(shift == SHIFT_4K || !(*entry & PRESENT) || (*entry & LARGE))
+                    break;
+            }
+        }
+        if(*entry & PRESENT)
+            flush.add(address);
+        bool large = shift > SHIFT_4K;
+        *entry = physical | PRESENT | flags | (large ? LARGE : 0) | MemoryType::pte_flags(type, large);
+
+        size_t size = size_t(1) << shift;
+        address += size;
+        physical += size;
+        length -= size;
+    }
+    return true;
+}
+/** \brief unmaps a range of virtual memory
+    \param address the page-aligned start of the range
+    \param length the length of the range, a multiple of the page size
+    \param release whether to free the mapped pages to the Heap once the
+    TLB has been flushed. Large pages can't be partly released.
+    \param flush receives the invalidations */
+void PageTable::unmap(char *address, size_t length, bool release, AddressSpace::Flush &flush)
+{
+    while(length) {
+        unsigned shift;
+        Entry *entry = lookup(address, shift);
+        size_t
+            size = size_t(1) << shift,
+            span = min(length, size - (reinterpret_cast<uintptr_t>(address) & (size - 1)));
+        if(*entry & PRESENT) {
+            if(span < size) {
+                // only part of a large page is to go, so split it and try again
+                assert(!release && "releasing part of a large page");
+                bool split_ok = walk(address, shift - 9, flush);
+                assert(split_ok && "out of memory splitting a large page");
+                (void)split_ok;
+                continue;
+            }
+            if(release)
+                flush.release(virt(*entry & ADDRESS & ~Entry(size - 1)), shift);
+            *entry = 0;
+            flush.add(address);
+        }
+        address += span;
+        length -= span;
+    }
+}
+/** \brief changes the permissions of a range of virtual memory
+    \param address the page-aligned start of the range
+    \param length the length of the range, a multiple of the page size
+    \param flags the new #WRITABLE and #USER bits
+    \param flush receives the invalidations
+    \returns true on success, or false if a large page couldn't be split */
+bool PageTable::protect(char *address, size_t length, Entry flags, AddressSpace::Flush &flush)
+{
+    while(length) {
+        unsigned shift;
+        Entry *entry = lookup(address, shift);
+        size_t
+            size = size_t(1) << shift,
+            span = min(length, size - (reinterpret_cast<uintptr_t>(address) & (size - 1)));
+        if(*entry & PRESENT) {
+            if(span < size) {
+                if(!walk(address, shift - 9, flush))
+                    return false;
+                continue;
+            }
+            Entry updated = (*entry & ~PERMISSIONS) | (flags & PERMISSIONS);
+            if(updated != *entry) {
+                *entry = updated;
+                flush.add(address);
+            }
+        }
+        address += span;
+        length -= span;
+    }
+    return true;
+}
+/** \brief translates a virtual address to a physical address
+    \param address the virtual address
+    \param physical receives the physical address
+    \returns true if the address is mapped */
+bool PageTable::translate(const char *address, Physical &physical) const
+{
+    unsigned shift;
+    Entry *entry = lookup(address, shift);
+    if(!(*entry & PRESENT))
+        return false;
+    Entry offset_mask = (Entry(1) << shift) - 1;
+    physical = (*entry & ADDRESS & ~offset_mask) | (reinterpret_cast<uintptr_t>(address) & offset_mask);
+    return true;
+}
+/** \brief copies a table and the tables below it (but not the pages they map)
+    \param from the table to copy
+    \param level the level of the table (4 for the PML4, 1 for a page table)
+    \param requirements where the copy of this table must be
+    \returns the physical address of the copy */
+PageTable::Physical PageTable::copy_table(const Entry *from, unsigned level, Heap::Requirements requirements)
+{
+    char *page = Heap::allocate_page(requirements);
+    assert(page && "out of memory copying page tables");
+    if(level == 1) {
+        // nothing below a page table to copy
+        String::copy_page(page, from);
+        return phys(page);
+    }
+    Entry *to = reinterpret_cast<Entry *>(page);
+    for(size_t i = 0; i < 512; ++i) {
+        Entry entry = from[i];
+        if((entry & PRESENT) && !(entry & LARGE))
+            entry = copy_table(table(entry), level - 1, Heap::REQ_ANY) | (entry & ~ADDRESS);
+        to[i] = entry;
+    }
+    return phys(page);
+}
+/** \brief copies the page table hierarchy into memory from the Heap
+    \param requirements where the PML4 must be (the other tables can be
+    anywhere)
+    \returns the physical address of the new PML4 */
+PageTable::Physical PageTable::copy(Heap::Requirements requirements) const
+{
+    return copy_table(reinterpret_cast<const Entry *>(virt(root)), 4, requirements);
+}
@@ -0,0 +1,73 @@
+// -*- mode: c++ -*-
+/**
+   \brief Page tables (headers)
+   \file
+*/
+
+#ifndef EXEC_PAGETABLE_HPP
+#define EXEC_PAGETABLE_HPP
+
+/** \addtogroup exec_pagetable
+    @{ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "exec/aspace.hpp"
+#include "exec/memory.hpp"
+#include "exec/memtype.hpp"
+#include "exec/types.hpp"
+
+/** \brief a four-level x86_64 page table hierarchy */
+class exec::PageTable {
+public:
+    typedef uint64_t Entry;     //!< a page table entry
+    typedef uint64_t Physical;  //!< a physical address
+
+    static const unsigned SHIFT_4K = 12; //!< log2 of the size of a small page
+    static const unsigned SHIFT_2M = 21; //!< log2 of the size of a large page
+    static const unsigned SHIFT_1G = 30; //!< log2 of the size of a huge page
+
+    static const Entry PRESENT = 1 << 0;  //!< the entry is valid
+    static const Entry WRITABLE = 1 << 1; //!< the page may be written
+    static const Entry USER = 1 << 2;     //!< the page may be accessed from user mode
+    static const Entry LARGE = 1 << 7;    //!< the entry maps a 2MiB or 1GiB page
+    static const Entry GLOBAL = 1 << 8;   //!< the entry survives a %cr3 reload
+    static const Entry ADDRESS = 0x000ffffffffff000; //!< the physical address
+    static const Entry PERMISSIONS = WRITABLE | USER; //!< bits changed by protect()
+
+    static const uintptr_t DIRECT_MAP = 0xffff800000000000; //!< virtual address of physical address zero
+
+    //! \returns the direct-mapped virtual address of a physical address
+    static char *virt(Physical physical) { return reinterpret_cast<char *>(physical + DIRECT_MAP); }
+    //! \returns the physical address of a direct-mapped virtual address
+    static Physical phys(const void *virtual_) { return reinterpret_cast<uintptr_t>(virtual_) - DIRECT_MAP; }
+    //! \returns true for addresses in the kernel's (upper) half
+    static bool is_kernel(const char *address) { return reinterpret_cast<intptr_t>(address) < 0; }
+private:
+    static bool gigabyte_pages; //!< whether 1GiB pages are supported
+
+    Physical root;              //!< physical address of the PML4
+
+    static Entry *table(Entry entry) { return reinterpret_cast<Entry *>(virt(entry & ADDRESS)); }
+    static Entry table_entry(const char *, char *);
+    static bool split(const char *, Entry &, unsigned, AddressSpace::Flush &);
+    Entry *walk(const char *, unsigned, AddressSpace::Flush &);
+    Entry *lookup(const char *, unsigned &) const;
+    static Physical copy_table(const Entry *, unsigned, Heap::Requirements);
+public:
+    /** \brief wraps an existing page table hierarchy
+        \param root_ the physical address of the PML4 */
+    explicit PageTable(Physical root_) : root(root_) {}
+
+    static void init(void);
+    bool map(char *, Physical, size_t, Entry, MemoryType::Type, AddressSpace::Flush &);
+    void unmap(char *, size_t, bool, AddressSpace::Flush &);
+    bool protect(char *, size_t, Entry, AddressSpace::Flush &);
+    bool translate(const char *, Physical &) const;
+    Physical copy(Heap::Requirements=Heap::REQ_ANY) const;
+};
+
+/** @} */
+
+#endif
@@ -0,0 +1,80 @@
+// -*- mode: c++ -*-
+/**
+   \brief Per-processor variables (implementation)
+   \file
+*/
+
+#include <stddef.h>
+#include <string.h>
+
+#include "exec/cpu.hpp"
+#include "exec/memory.hpp"
+#include "exec/percpu.hpp"
+#include "exec/util.hpp"
+#include "exec/x86.hpp"
+
+using namespace exec;
+
+/** \defgroup exec_percpu PerCPU: per-processor variables
+
+    Variables marked #EXEC_PERCPU are linked into the .percpu section (see
+    kernel.lds), and each processor has its own copy of that section. The
+    copy in the kernel image belongs to CPU 0; the others are allocated from
+    the Heap as each processor is brought up, starting as copies of CPU 0's,
+    so a processor must set any variables that shouldn't be inherited (like
+    CPU::this_cpu) before it uses them.
+
+    A processor's GS base is the distance from CPU 0's copy to its own (so it
+    is zero on CPU 0), which means that a variable's link address used as a
+    %gs-relative address finds the calling processor's copy. Accessing one
+    costs no more than accessing a global variable, and needs no lock as long
+    as the processor isn't interrupted between reading and writing it.
+
+    IA32_KERNEL_GS_BASE is zeroed: it will hold the user mode GS base while
+    the kernel is running, to be exchanged with \c swapgs on entry from and
+    exit to user mode.
+
+    @{
+*/
+
+intptr_t PerCPU::offsets[CPU::MAX_CPUS];
+intptr_t PerCPU::offset EXEC_PERCPU = 0;
+
+/** @} */
+
+extern "C" char __percpu_start, __percpu_end;
+
+namespace {
+    const uint32_t MSR_GS_BASE = 0xc0000101;
+    const uint32_t MSR_KERNEL_GS_BASE = 0xc0000102;
+}
+
+
+
+/* ====================================================================== */
+/** \brief allocates a processor's copy of the per-processor variables
+    \param cpu the processor
+    \returns true on success, or false if there wasn't enough memory */
+bool PerCPU::allocate(unsigned cpu)
+{
+    size_t size = size_t(&__percpu_end - &__percpu_start);
+    Heap::Order order = 0;
+    while((Heap::PAGE_SIZE << order) < size)
+        ++order;
+    char *area = Heap::allocate_pages(order);
+    if(!area)
+        return false;
+    memcpy(area, &__percpu_start, size);
+    offsets[cpu] = area - &__percpu_start;
+    *pointer(offset, cpu) = offsets[cpu];
+    return true;
+}
+/** \brief points the GS base of the processor we're running on at its copy
+    of the per-processor variables, which allocate() must have made (except
+    for CPU 0, which uses the copy in the kernel image)
+    \param cpu the processor we're running on */
+void PerCPU::init_cpu(unsigned cpu)
+{
+    msr(MSR_GS_BASE, uint64_t(offsets[cpu]));
+    msr(MSR_KERNEL_GS_BASE, 0);
+}
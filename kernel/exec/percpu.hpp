@@ -0,0 +1,74 @@
+// -*- mode: c++ -*-
+/**
+   \brief Per-processor variables (headers)
+   \file
+*/
+
+#ifndef EXEC_PERCPU_HPP
+#define EXEC_PERCPU_HPP
+
+/** \addtogroup exec_percpu
+    @{ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "exec/types.hpp"
+
+/** \brief places a variable in the .percpu section, so that each processor
+    has its own copy of it, to be accessed through PerCPU */
+#define EXEC_PERCPU __attribute__((section(".percpu")))
+
+/** \brief access to the calling processor's copies of per-processor variables
+
+    Each accessor takes the variable itself (CPU 0's copy), and compiles to a
+    single %gs-relative instruction when inlined.
+*/
+class exec::PerCPU {
+    static intptr_t offsets[];  //!< each processor's GS base, indexed by CPU::ID
+    static intptr_t offset;     //!< (per-processor) this processor's GS base
+public:
+    //! \returns the calling processor's copy of a variable
+    template <typename T> static T read(const T &variable)
+    {
+        T value;
+        asm volatile("mov %%gs:%1, %0" : "=r"(value) : "m"(variable));
+        return value;
+    }
+    //! sets the calling processor's copy of a variable
+    template <typename T> static void write(T &variable, T value)
+    {
+        asm volatile("mov %1, %%gs:%0" : "=m"(variable) : "r"(value));
+    }
+    //! adds to the calling processor's copy of a variable
+    template <typename T> static void add(T &variable, T value)
+    {
+        asm volatile("add %1, %%gs:%0" : "+m"(variable) : "r"(value));
+    }
+    /** \brief adds to the calling processor's copy of a variable, in one
+        instruction so that an interrupt can't come between the read and the
+        write
+        \returns its previous value */
+    template <typename T> static T fetch_add(T &variable, T value)
+    {
+        asm volatile("xadd %0, %%gs:%1" : "+r"(value), "+m"(variable));
+        return value;
+    }
+    //! \returns the address of the calling processor's copy of a variable
+    template <typename T> static T *pointer(T &variable)
+    {
+        return reinterpret_cast<T *>(reinterpret_cast<intptr_t>(&variable) + read(offset));
+    }
+    //! \returns the address of a processor's copy of a variable
+    template <typename T> static T *pointer(T &variable, unsigned cpu)
+    {
+        return reinterpret_cast<T *>(reinterpret_cast<intptr_t>(&variable) + offsets[cpu]);
+    }
+
+    static bool allocate(unsigned);
+    static void init_cpu(unsigned);
+};
+
+/** @} */
+
+#endif
@@ -0,0 +1,100 @@
+// -*- mode: c++ -*-
+/**
+   \brief Serial ports (implementation)
+   \file
+*/
+
+#include <stddef.h>
+
+#include "exec/serial.hpp"
+#include "exec/x86.hpp"
+
+using namespace exec;
+
+/** \defgroup exec_serial Serial: serial ports
+
+    A 16550A has a 16 byte transmit FIFO, so rather than waiting for the
+    transmitter to empty before every byte, up to 16 bytes are written each
+    time it does, and the count of bytes written since is all that needs to
+    be kept. Older UARTs without a working FIFO are detected when the port is
+    set up, and written one byte at a time.
+
+    For the register layout, see e.g.
+    <http://www.lammertbies.nl/comm/info/serial-uart.html>.
+
+    @{
+*/
+
+/** @} */
+
+namespace {
+    const uint16_t REG_DATA = 0;        //!< transmit/receive buffer (divisor low with DLAB)
+    const uint16_t REG_IER = 1;         //!< interrupt enable (divisor high with DLAB)
+    const uint16_t REG_FCR = 2;         //!< FIFO control (write)
+    const uint16_t REG_IIR = 2;         //!< interrupt identification (read)
+    const uint16_t REG_LCR = 3;         //!< line control
+    const uint16_t REG_MCR = 4;         //!< modem control
+    const uint16_t REG_LSR = 5;         //!< line status
+
+    const uint8_t LCR_8N1 = 0x03;
+    const uint8_t LCR_DLAB = 0x80;
+    const uint8_t FCR_ENABLE_CLEAR = 0xc7; //!< enable and clear the FIFOs, 14 byte receive threshold
+    const uint8_t IIR_FIFO_ENABLED = 0xc0;
+    const uint8_t MCR_DTR_RTS = 0x03;
+    const uint8_t LSR_THRE = 0x20;      //!< transmitter holding register (or FIFO) empty
+}
+
+
+
+/* ====================================================================== */
+/** \brief sets up a serial port for 8N1 with its interrupts disabled
+    \param port_ the base I/O port
+    \param baud the bit rate, which is rounded to one the UART can do */
+Serial::Serial(uint16_t port_, unsigned baud)
+    : port(port_), fifo_size(1), fifo_space(0)
+{
+    unsigned divisor = MAX_BAUD / (baud ? baud : 1);
+    if(divisor == 0) {
+        divisor = 1;
+    } else if(divisor > 0xffff) {
+        divisor = 0xffff;
+    }
+
+    outb(uint16_t(port + REG_LCR), 0);
+    outb(uint16_t(port + REG_IER), 0);
+    outb(uint16_t(port + REG_LCR), LCR_DLAB);
+    outw(uint16_t(port + REG_DATA), uint16_t(divisor));
+    outb(uint16_t(port + REG_LCR), LCR_8N1);
+    outb(uint16_t(port + REG_FCR), FCR_ENABLE_CLEAR);
+    outb(uint16_t(port + REG_MCR), MCR_DTR_RTS);
+    if((inb(uint16_t(port + REG_IIR)) & IIR_FIFO_ENABLED) == IIR_FIFO_ENABLED)
+        fifo_size = FIFO_SIZE;
+}
+bool Serial::transmitter_empty(void) const
+{
+    return inb(uint16_t(port + REG_LSR)) & LSR_THRE;
+}
+//! writes a byte, waiting for room in the FIFO if there is none
+void Serial::put(char c)
+{
+    if(!fifo_space) {
+        while(!transmitter_empty())
+            asm volatile("pause");
+        fifo_space = fifo_size;
+    }
+    outb(port, uint8_t(c));
+    --fifo_space;
+}
+//! writes a character, turning newlines into CRLF
+void Serial::putc(char c)
+{
+    if(c == '\n')
+        put('\r');
+    put(c);
+}
+//! writes a string, turning newlines into CRLF
+void Serial::write(const char *start, const char *end)
+{
+    while(start < end)
+        putc(*start++);
+}
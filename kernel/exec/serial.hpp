@@ -0,0 +1,46 @@
+// -*- mode: c++ -*-
+/**
+   \brief Serial ports (headers)
+   \file
+*/
+
+#ifndef EXEC_SERIAL_HPP
+#define EXEC_SERIAL_HPP
+
+/** \addtogroup exec_serial
+    @{ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "exec/types.hpp"
+
+/** \brief a 16550 UART, written synchronously
+
+    This is shared by the bootloader and the kernel; the kernel normally
+    writes through a BufferedSerial instead.
+*/
+class exec::Serial {
+public:
+    static const uint16_t COM1 = 0x3f8;   //!< the first serial port
+    static const unsigned MAX_BAUD = 115200; //!< the fastest rate the UART supports
+protected:
+    static const size_t FIFO_SIZE = 16; //!< size of a 16550A's transmit FIFO
+
+    uint16_t port;              //!< the base I/O port
+    size_t fifo_size;           //!< bytes that can be written when the transmitter is empty
+    size_t fifo_space;          //!< bytes that can be written without waiting
+
+    //! \returns true if the transmit FIFO (or holding register) is empty
+    bool transmitter_empty(void) const;
+    void put(char);
+public:
+    explicit Serial(uint16_t=COM1, unsigned=MAX_BAUD);
+
+    void putc(char);
+    void write(const char *, const char *);
+};
+
+/** @} */
+
+#endif
@@ -0,0 +1,224 @@
+// -*- mode: c++ -*-
+/**
+   \brief Memory and string functions (implementation)
+   \file
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "exec/init.hpp"
+#include "exec/memory.hpp"
+#include "exec/string.hpp"
+#include "exec/x86.hpp"
+
+using namespace exec;
+
+/** \defgroup exec_string String: memory and string functions
+
+    The functions in string.h which the kernel uses, or which the compiler
+    may call for it (memcpy(), memmove() and memset()), and clear_page()
+    and copy_page() for whole pages.
+
+    Copying and filling use \c rep \c movs and \c rep \c stos. On processors
+    with ERMS or FSRM (see init()), the byte forms are as fast as anything
+    else at any size, so they are used throughout; otherwise the bulk is
+    done a word at a time and only the tail a byte at a time. The bootloader
+    never calls init(), so it always uses words.
+
+    The searches (memchr(), strlen() and strnlen()) read a word at a time
+    from word-aligned addresses, which can't cross into an unmapped page,
+    and find a matching byte in each word with a few arithmetic operations.
+    memcmp() compares a word at a time until it finds a difference.
+
+    Nothing here may be written as a byte loop the compiler could turn back
+    into a call to memset() or memcpy().
+
+    @{
+*/
+
+bool String::fast_strings = false;
+
+/** @} */
+
+namespace {
+#ifdef __x86_64__
+#define STRING_WORD "q"
+#else
+#define STRING_WORD "l"
+#endif
+
+    typedef uintptr_t Word;
+    //! a word that may alias anything
+    typedef Word AliasedWord __attribute__((may_alias));
+    //! a word that may alias anything, at any address
+    typedef Word UnalignedWord __attribute__((may_alias, aligned(1)));
+
+    const size_t WORD_SIZE = sizeof(Word);
+    const Word ONES = ~Word(0) / 0xff;  //!< 0x01 in every byte
+    const Word HIGHS = ONES << 7;       //!< 0x80 in every byte
+
+    const uint32_t CPUID7_EBX_ERMS = 1 << 9; //!< enhanced rep movsb/stosb
+    const uint32_t CPUID7_EDX_FSRM = 1 << 4; //!< fast short rep movsb
+
+    /** \returns a word with the top bit of its lowest zero byte set, and
+        perhaps those of higher bytes, or 0 if it has none */
+    inline Word zero_bytes(Word word)
+    {
+        return (word - ONES) & ~word & HIGHS;
+    }
+    //! \returns the index of the lowest byte flagged by zero_bytes()
+    inline size_t first_byte(Word mask)
+    {
+        return size_t(__builtin_ctzl(mask)) / 8;
+    }
+
+    //! fills bytes with \c rep \c stosb \returns the end of the fill
+    inline char *fill_bytes(char *to, uint8_t byte, size_t count)
+    {
+        asm volatile("rep stosb" : "+D"(to), "+c"(count) : "a"(byte) : "memory");
+        return to;
+    }
+    //! fills words with \c rep \c stos \returns the end of the fill
+    inline char *fill_words(char *to, Word word, size_t count)
+    {
+        asm volatile("rep stos" STRING_WORD : "+D"(to), "+c"(count) : "a"(word) : "memory");
+        return to;
+    }
+    //! copies bytes forwards with \c rep \c movsb, advancing both pointers
+    inline void copy_bytes(char *&to, const char *&from, size_t count)
+    {
+        asm volatile("rep movsb" : "+D"(to), "+S"(from), "+c"(count) : : "memory");
+    }
+    //! copies words forwards with \c rep \c movs, advancing both pointers
+    inline void copy_words(char *&to, const char *&from, size_t count)
+    {
+        asm volatile("rep movs" STRING_WORD : "+D"(to), "+S"(from), "+c"(count) : : "memory");
+    }
+}
+
+
+
+/* ====================================================================== */
+//! checks whether the processor's byte string instructions are fast
+EXEC_INIT void String::init(void)
+{
+    uint32_t regs[4];
+    cpuid(0, 0, regs);
+    if(regs[0] < 7)
+        return;
+    cpuid(7, 0, regs);
+    fast_strings = (regs[1] & CPUID7_EBX_ERMS) || (regs[3] & CPUID7_EDX_FSRM);
+}
+//! fills a page with zeroes \param page the page, which must be page-aligned
+void String::clear_page(void *page)
+{
+    char *to = static_cast<char *>(page);
+    if(fast_strings)
+        fill_bytes(to, 0, Heap::PAGE_SIZE);
+    else
+        fill_words(to, 0, Heap::PAGE_SIZE / WORD_SIZE);
+}
+/** \brief copies a page
+    \param to the destination, which must be page-aligned
+    \param from the source, which must be page-aligned */
+void String::copy_page(void *to, const void *from)
+{
+    char *t = static_cast<char *>(to);
+    const char *f = static_cast<const char *>(from);
+    if(fast_strings)
+        copy_bytes(t, f, Heap::PAGE_SIZE);
+    else
+        copy_words(t, f, Heap::PAGE_SIZE / WORD_SIZE);
+}
+
+void *memset(void *s, int c, size_t n)
+{
+    char *to = static_cast<char *>(s);
+    uint8_t byte = uint8_t(c);
+    if(!String::fast() && n >= WORD_SIZE) {
+        to = fill_words(to, byte * ONES, n / WORD_SIZE);
+        n %= WORD_SIZE;
+    }
+    fill_bytes(to, byte, n);
+    return s;
+}
+void *memcpy(void *dest, const void *src, size_t n)
+{
+    char *to = static_cast<char *>(dest);
+    const char *from = static_cast<const char *>(src);
+    if(!String::fast() && n >= WORD_SIZE) {
+        copy_words(to, from, n / WORD_SIZE);
+        n %= WORD_SIZE;
+    }
+    copy_bytes(to, from, n);
+    return dest;
+}
+void *memmove(void *dest, const void *src, size_t n)
+{
+    char *to = static_cast<char *>(dest);
+    const char *from = static_cast<const char *>(src);
+    // a forward copy is safe unless the destination starts inside the source
+    if(reinterpret_cast<uintptr_t>(to) - reinterpret_cast<uintptr_t>(from) >= n)
+        return memcpy(dest, src, n);
+
+    // copy backwards, from the last byte: first the bytes past the last
+    // whole word, then the words
+    size_t bytes = n % WORD_SIZE, words = n / WORD_SIZE;
+    to += n - 1;
+    from += n - 1;
+    asm volatile("std\n\t"
+                 "rep movsb\n\t"
+                 "sub %4, %0\n\t"
+                 "sub %4, %1\n\t"
+                 "mov %3, %2\n\t"
+                 "rep movs" STRING_WORD "\n\t"
+                 "cld"
+                 : "+D"(to), "+S"(from), "+c"(bytes)
+                 : "r"(words), "i"(WORD_SIZE - 1)
+                 : "memory");
+    return dest;
+}
+int memcmp(const void *s1, const void *s2, size_t n)
+{
+    const uint8_t *a = static_cast<const uint8_t *>(s1), *b = static_cast<const uint8_t *>(s2);
+    for(; n >= WORD_SIZE; n -= WORD_SIZE, a += WORD_SIZE, b += WORD_SIZE)
+        if(*reinterpret_cast<const UnalignedWord *>(a) != *reinterpret_cast<const UnalignedWord *>(b))
+            break;
+    for(; n; --n, ++a, ++b)
+        if(*a != *b)
+            return int(*a) - int(*b);
+    return 0;
+}
+void *memchr(const void *s, int c, size_t n)
+{
+    const uint8_t *p = static_cast<const uint8_t *>(s);
+    uint8_t byte = uint8_t(c);
+    for(; n && reinterpret_cast<uintptr_t>(p) % WORD_SIZE; --n, ++p)
+        if(*p == byte)
+            return const_cast<uint8_t *>(p);
+    Word pattern = byte * ONES;
+    for(; n >= WORD_SIZE; n -= WORD_SIZE, p += WORD_SIZE)
+        if(Word mask = zero_bytes(*reinterpret_cast<const AliasedWord *>(p) ^ pattern))
+            return const_cast<uint8_t *>(p + first_byte(mask));
+    for(; n; --n, ++p)
+        if(*p == byte)
+            return const_cast<uint8_t *>(p);
+    return NULL;
+}
+size_t strlen(const char *s)
+{
+    const char *p = s;
+    for(; reinterpret_cast<uintptr_t>(p) % WORD_SIZE; ++p)
+        if(!*p)
+            return size_t(p - s);
+    for(;; p += WORD_SIZE)
+        if(Word mask = zero_bytes(*reinterpret_cast<const AliasedWord *>(p)))
+            return size_t(p - s) + first_byte(mask);
+}
+size_t strnlen(const char *s, size_t maxlen)
+{
+    const void *end = memchr(s, 0, maxlen);
+    return end ? size_t(static_cast<const char *>(end) - s) : maxlen;
+}
@@ -0,0 +1,32 @@
+// -*- mode: c++ -*-
+/**
+   \brief Memory and string functions (headers)
+   \file
+*/
+
+#ifndef EXEC_STRING_HPP
+#define EXEC_STRING_HPP
+
+/** \addtogroup exec_string
+    @{ */
+
+#include <stddef.h>
+#include <string.h>
+
+#include "exec/types.hpp"
+
+/** \brief the processor's string instructions, as used by the functions in
+    string.h, and whole-page versions of them */
+class exec::String {
+    static bool fast_strings;   //!< whether \c rep \c movsb and \c rep \c stosb are fast
+public:
+    //! \returns whether byte-at-a-time string instructions are fast (ERMS or FSRM)
+    static bool fast(void) { return fast_strings; }
+    static void init(void);
+    static void clear_page(void *);
+    static void copy_page(void *, const void *);
+};
+
+/** @} */
+
+#endif
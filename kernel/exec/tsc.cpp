@@ -0,0 +1,69 @@
+// -*- mode: c++ -*-
+/**
+   \brief Time stamp counter (implementation)
+   \file
+*/
+
+#include <stddef.h>
+
+#include "exec/tsc.hpp"
+#include "exec/x86.hpp"
+
+using namespace exec;
+
+/** \defgroup exec_tsc TSC: time stamp counter
+
+    The time stamp counter is the cheapest clock there is, one instruction
+    and no I/O, but its frequency has to be measured. This is done once, the
+    first time it's needed, by running PIT channel 2 as a one-shot timer for
+    #CALIBRATION_MS with the speaker disconnected and reading the time stamp
+    counter either side.
+
+    \note The time stamp counter is assumed to run at a constant rate, and to
+    be synchronised between processors, which is true of every processor that
+    supports long mode apart from the very earliest.
+
+    @{
+*/
+
+uint64_t TSC::frequency_khz = 0;
+uint64_t TSC::boot_tsc = 0;
+
+/** @} */
+
+namespace {
+    const uint16_t PIT_CHANNEL2 = 0x42;
+    const uint16_t PIT_COMMAND = 0x43;
+    const uint16_t PORT_B = 0x61;       //!< speaker control, and PIT channel 2's gate and output
+
+    const uint8_t PORT_B_GATE2 = 1 << 0;
+    const uint8_t PORT_B_SPEAKER = 1 << 1;
+    const uint8_t PORT_B_OUT2 = 1 << 5;
+
+    const uint32_t PIT_HZ = 1193182;
+    const uint32_t CALIBRATION_MS = 10;
+}
+
+
+
+/* ====================================================================== */
+//! measures the time stamp counter frequency
+void TSC::calibrate(void)
+{
+    static const uint16_t latch = PIT_HZ / (1000 / CALIBRATION_MS);
+    outb(PORT_B, uint8_t((inb(PORT_B) & ~PORT_B_SPEAKER) | PORT_B_GATE2));
+    outb(PIT_COMMAND, 0xb0);    // channel 2, lobyte/hibyte, mode 0, binary
+    outb(PIT_CHANNEL2, uint8_t(latch));
+    outb(PIT_CHANNEL2, uint8_t(latch >> 8));
+    uint64_t start = rdtsc();
+    while(!(inb(PORT_B) & PORT_B_OUT2))
+        ;
+    frequency_khz = (rdtsc() - start) / CALIBRATION_MS;
+}
+//! busy-waits for a number of microseconds
+void TSC::delay(uint64_t us)
+{
+    uint64_t end = now() + from_us(us);
+    while(now() < end)
+        asm volatile("pause");
+}
@@ -0,0 +1,54 @@
+// -*- mode: c++ -*-
+/**
+   \brief Time stamp counter (headers)
+   \file
+*/
+
+#ifndef EXEC_TSC_HPP
+#define EXEC_TSC_HPP
+
+/** \addtogroup exec_tsc
+    @{ */
+
+#include <stdint.h>
+
+#include "exec/types.hpp"
+#include "exec/x86.hpp"
+
+/** \brief the processor's time stamp counter, calibrated against the PIT */
+class exec::TSC {
+    static uint64_t frequency_khz; //!< ticks per millisecond, or 0 if not calibrated
+    static uint64_t boot_tsc;   //!< the reading when the system started, or 0 if not known
+
+    static void calibrate(void);
+public:
+    //! \returns the current value of the time stamp counter
+    static uint64_t now(void) { return rdtsc(); }
+    //! \returns the time stamp counter's frequency in kHz, calibrating it on first use
+    static uint64_t khz(void)
+    {
+        if(!frequency_khz)
+            calibrate();
+        return frequency_khz;
+    }
+    /** \returns the number of microseconds in a number of ticks
+
+        This divides first, as a whole reading of the counter times 1000
+        overflows within months. */
+    static uint64_t to_us(uint64_t ticks)
+    {
+        uint64_t k = khz();
+        return ticks / k * 1000 + ticks % k * 1000 / k;
+    }
+    //! \returns the number of ticks in a number of microseconds
+    static uint64_t from_us(uint64_t us) { return us * khz() / 1000; }
+    //! records the reading when the system started, for since_boot()
+    static void set_boot(uint64_t tsc) { boot_tsc = tsc; }
+    //! \returns the number of ticks between the system starting and a reading
+    static uint64_t since_boot(uint64_t tsc) { return tsc - boot_tsc; }
+    static void delay(uint64_t);
+};
+
+/** @} */
+
+#endif
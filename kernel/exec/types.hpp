@@ -22,14 +22,34 @@
 
 */
 namespace exec {
+    class ACPI;
+    class AddressSpace;
+    class BootProfile;
+    class BufferFormatter;
+    class BufferedFormatter;
+    class BufferedSerial;
     class Cache;
+    class CPU;
     class Formatter;
+    class FPU;
     class Handover;
     class Heap;
+    class Interrupt;
+    class IOAPIC;
+    class LocalAPIC;
+    class Log;
+    class Memblock;
+    class MemoryType;
     class MinNode;
     class Node;
     class Page;
+    class PageTable;
+    class PerCPU;
+    class Serial;
+    class String;
     class Task;
+    class TSC;
+    class VirtualHeap;
     template <typename T, int fudge> struct VarArray;
     template <typename T> class MinList;
 }
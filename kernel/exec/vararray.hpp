@@ -73,6 +73,10 @@ public:
     iterator begin(void) const { return iterator(first); }
     //! gets the one-past-end entry
     iterator end(void) const { return iterator(first + size); }
+    //! gets the address of the array
+    const char *address(void) const { return first; }
+    //! gets the total size of the array, in bytes
+    uint32_t length(void) const { return size; }
     //! gets the number of entries
     size_t count(void) const {
         size_t n = 0;
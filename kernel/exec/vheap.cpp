@@ -0,0 +1,145 @@
+// -*- mode: c++ -*-
+/**
+   \brief Virtually contiguous allocator (implementation)
+   \file
+*/
+
+#include <assert.h>
+#include <new>
+
+#include "exec/aspace.hpp"
+#include "exec/format.hpp"
+#include "exec/memory.hpp"
+#include "exec/pagetable.hpp"
+#include "exec/util.hpp"
+#include "exec/vheap.hpp"
+
+using namespace exec;
+
+/** \defgroup exec_vheap VirtualHeap: virtually contiguous allocation
+
+    Large allocations are hard to satisfy from the buddy allocator once memory
+    has become fragmented, as they need a physically contiguous block of high
+    order. Few users actually need physically contiguous memory though, so the
+    VirtualHeap instead allocates order-0 pages wherever it can find them and
+    maps them into a contiguous range of a dedicated virtual window.
+
+    Each allocation is described by an Area, and is followed by an unmapped
+    guard page so that overruns fault rather than silently corrupting the
+    next allocation. Areas are kept in a list sorted by address and allocated
+    first-fit, which is O(N) but large allocations are expected to be rare.
+
+    The pages are mapped into address space zero with PageTable, so that
+    mapping or unmapping an allocation costs at most one TLB flush.
+
+    @{
+*/
+
+/** \brief a single VirtualHeap allocation (private) */
+class exec::VirtualHeap::Area {
+    friend class VirtualHeap;
+    Area *next;                 //!< next Area in address order
+    char *start;                //!< start of the allocation
+    size_t pages;               //!< number of mapped pages (excluding guard page)
+
+    Area(void) = delete;                    //!< **deleted**
+    Area(const Area &) = delete;            //!< **deleted**
+    Area &operator=(const Area &) = delete; //!< **deleted**
+    Area(Area *next_, char *start_, size_t pages_)
+        : next(next_), start(start_), pages(pages_)
+    {}
+    //! \returns one-past-end address of the area, including its guard page
+    char *end(void) const { return start + ((pages + 1) << Heap::PAGE_SHIFT); }
+};
+
+//! all allocations, in address order
+VirtualHeap::Area *VirtualHeap::areas = NULL;
+
+/** @} */
+
+/* ====================================================================== */
+/** \brief maps freshly-allocated pages at an address
+    \param start the page-aligned virtual address to map at
+    \param pages the number of pages to map
+    \returns true on success, or false (with nothing mapped) on failure */
+bool VirtualHeap::map(char *start, size_t pages)
+{
+    AddressSpace::Flush flush(AddressSpace::kernel());
+    PageTable tables(AddressSpace::kernel().root());
+    for(size_t i = 0; i < pages; ++i) {
+        char *address = start + (i << Heap::PAGE_SHIFT);
+        char *page = Heap::allocate_page();
+        if(!page || !tables.map(address, PageTable::phys(page), Heap::PAGE_SIZE, PageTable::WRITABLE, MemoryType::WB, flush)) {
+            if(page)
+                Heap::free_page(page);
+            tables.unmap(start, i << Heap::PAGE_SHIFT, true, flush);
+            return false;
+        }
+    }
+    return true;
+}
+/** \brief unmaps and frees pages previously mapped by map()
+    \param start the page-aligned virtual address to unmap from
+    \param pages the number of pages to unmap */
+void VirtualHeap::unmap(char *start, size_t pages)
+{
+    AddressSpace::kernel().unmap(start, pages << Heap::PAGE_SHIFT, true);
+}
+/** \brief allocates virtually contiguous memory
+    \param size the size of the allocation in bytes
+    \returns the page-aligned allocation, or NULL on failure */
+char *VirtualHeap::allocate(size_t size)
+{
+    size_t pages = round_up(size, Heap::PAGE_SIZE) >> Heap::PAGE_SHIFT;
+    if(!pages)
+        return NULL;
+    size_t span = (pages + 1) << Heap::PAGE_SHIFT; // includes guard page
+
+    // find the first gap large enough
+    Area **link = &areas;
+    uintptr_t start = BEGIN;
+    while(*link && start + span > reinterpret_cast<uintptr_t>((*link)->start)) {
+        start = reinterpret_cast<uintptr_t>((*link)->end());
+        link = &(*link)->next;
+    }
+    if(start + span > END)
+        return NULL;
+
+    char *memory = Heap::allocate_bytes(sizeof(Area));
+    if(!memory)
+        return NULL;
+    Area *area = new (memory) Area(*link, reinterpret_cast<char *>(start), pages);
+    if(!map(area->start, pages)) {
+        Heap::free_bytes(memory);
+        return NULL;
+    }
+    *link = area;
+    return area->start;
+}
+/** \brief releases memory obtained from allocate()
+    \param allocation the address returned by allocate() */
+void VirtualHeap::release(char *allocation)
+{
+    for(Area **link = &areas; *link; link = &(*link)->next) {
+        Area *area = *link;
+        if(area->start == allocation) {
+            *link = area->next;
+            unmap(area->start, area->pages);
+            Heap::free_bytes(reinterpret_cast<char *>(area));
+            return;
+        }
+    }
+    assert(!"VirtualHeap::release() of unallocated memory");
+}
+void VirtualHeap::dump(Formatter &formatter)
+{
+    EXEC_FORMAT(formatter, "VirtualHeap window [%p, %p):\n",
+                reinterpret_cast<char *>(BEGIN), reinterpret_cast<char *>(END));
+    size_t total = 0;
+    for(Area *area = areas; area; area = area->next) {
+        EXEC_FORMAT(formatter, "  [%p, %p) %'zd pages\n",
+                  area->start, area->start + (area->pages << Heap::PAGE_SHIFT), area->pages);
+        total += area->pages;
+    }
+    EXEC_FORMAT(formatter, "  %'zd pages (%'zd bytes) allocated\n", total, total << Heap::PAGE_SHIFT);
+}
@@ -0,0 +1,45 @@
+// -*- mode: c++ -*-
+/**
+   \brief Virtually contiguous allocator (headers)
+   \file
+*/
+
+#ifndef EXEC_VHEAP_HPP
+#define EXEC_VHEAP_HPP
+
+/** \addtogroup exec_vheap
+    @{ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "exec/types.hpp"
+
+/** \brief allocator of virtually contiguous, physically discontiguous memory */
+class exec::VirtualHeap {
+    class Area;
+
+    static Area *areas;
+
+    static const uintptr_t BEGIN = 0xffffc00000000000; //!< start of the virtual window
+    static const uintptr_t END   = 0xffffc08000000000; //!< end of the virtual window
+
+    static bool map(char *, size_t);
+    static void unmap(char *, size_t);
+public:
+    static char *allocate(size_t);
+    static void release(char *);
+    /** \brief tests whether an address came from the VirtualHeap
+        \param address the address to test
+        \returns true if the address lies in the VirtualHeap's virtual window */
+    static bool contains(const char *address)
+    {
+        uintptr_t a = reinterpret_cast<uintptr_t>(address);
+        return a >= BEGIN && a < END;
+    }
+    static void dump(Formatter &);
+};
+
+/** @} */
+
+#endif
@@ -0,0 +1,129 @@
+// -*- mode: c++ -*-
+/**
+   \brief x86 instruction wrappers (headers)
+   \file
+
+   These are shared between the 32 bit bootloader and the 64 bit kernel, so
+   control registers are passed around as uintptr_t and the assembler picks
+   the appropriate register width.
+*/
+
+#ifndef EXEC_X86_HPP
+#define EXEC_X86_HPP
+
+#include <stdint.h>
+
+inline void outb(uint16_t p, uint8_t a)
+{
+    asm volatile("outb %0, %w1" : : "a"(a), "Nd"(p));
+}
+inline uint8_t inb(uint16_t p)
+{
+    uint8_t a;
+    asm volatile("inb %w1, %0" : "=a"(a) : "Nd"(p));
+    return a;
+}
+inline void outw(uint16_t p, uint16_t a)
+{
+    asm volatile("outw %w0, %w1" : : "a"(a), "Nd"(p));
+}
+inline void outw(uint16_t p, uint8_t al, uint8_t ah)
+{
+    asm volatile("outw %w0, %w1" : : "a"(al + 256 * ah), "Nd"(p));
+}
+inline uint16_t inw(uint16_t p)
+{
+    uint16_t a;
+    asm volatile("inw %w1, %w0" : "=a"(a) : "Nd"(p));
+    return a;
+}
+inline void outl(uint16_t p, uint32_t a)
+{
+    asm volatile("outl %0, %w1" : : "a"(a), "Nd"(p));
+}
+inline uint32_t inl(uint16_t p)
+{
+    uint32_t a;
+    asm volatile("inl %w1, %0" : "=a"(a) : "Nd"(p));
+    return a;
+}
+
+inline void cr3(uintptr_t value) {
+    asm volatile("mov %0, %%cr3" : : "r"(value) : "memory");
+}
+
+inline uintptr_t cr3(void) {
+    uintptr_t ret;
+    asm volatile("mov %%cr3, %0" : "=r"(ret) : );
+    return ret;
+}
+
+inline void cr4(uintptr_t value) {
+    asm volatile("mov %0, %%cr4" : : "r"(value));
+}
+
+inline uintptr_t cr4(void) {
+    uintptr_t ret;
+    asm volatile("mov %%cr4, %0" : "=r"(ret) : );
+    return ret;
+}
+
+inline void cr0(uintptr_t value) {
+    asm volatile("mov %0, %%cr0" : : "r"(value));
+}
+
+inline uintptr_t cr0(void) {
+    uintptr_t ret;
+    asm volatile("mov %%cr0, %0" : "=r"(ret) : );
+    return ret;
+}
+
+/** \brief writes an extended control register (with \c xsetbv)
+    \param xcr the register
+    \param value the value */
+inline void xcr(uint32_t xcr, uint64_t value) {
+    asm volatile("xsetbv" : : "a"(uint32_t(value)), "d"(uint32_t(value >> 32)), "c"(xcr));
+}
+
+inline void msr(uint32_t msr, uint64_t value) {
+    uint32_t eax = uint32_t(value), edx = uint32_t(value >> 32);
+    asm volatile("wrmsr\n"
+                 :
+                 : "a"(eax), "d"(edx), "c"(msr)
+        );
+}
+
+inline uint64_t msr(uint32_t msr) {
+    uint32_t eax, edx;
+    asm volatile(
+        "rdmsr\n"
+        : "=a"(eax), "=d"(edx)
+        : "c"(msr)
+        );
+    return uint64_t(eax) | (uint64_t(edx) << 32);
+}
+
+/** \brief executes CPUID
+    \param leaf the leaf (%eax)
+    \param subleaf the subleaf (%ecx)
+    \param regs receives %eax, %ebx, %ecx and %edx, in that order */
+inline void cpuid(uint32_t leaf, uint32_t subleaf, uint32_t regs[4]) {
+    asm volatile("cpuid"
+                 : "=a"(regs[0]), "=b"(regs[1]), "=c"(regs[2]), "=d"(regs[3])
+                 : "a"(leaf), "c"(subleaf)
+        );
+}
+
+//! reads the time stamp counter
+inline uint64_t rdtsc(void) {
+    uint32_t eax, edx;
+    asm volatile("rdtsc" : "=a"(eax), "=d"(edx));
+    return uint64_t(eax) | (uint64_t(edx) << 32);
+}
+
+//! invalidates the TLB entry for a single page
+inline void invlpg(const void *address) {
+    asm volatile("invlpg (%0)" : : "r"(address) : "memory");
+}
+
+#endif